@@ -0,0 +1,353 @@
+/*
+ *  alarm.c -  Fan control daemon for MacBook
+ *
+ *  Copyright (C) 2010  Mikael Strom <mikael@sesamiq.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  Hardware temperature alarms. tempN_max of every sensor feeding a source
+ *  is set to that source's ceiling, tempN_crit to temp_crit, and the
+ *  tempN_max_alarm / tempN_crit_alarm attributes are polled for POLLPRI,
+ *  which drivers raising interrupts signal with sysfs_notify(). The cycle
+ *  wait polls them next to a CLOCK_BOOTTIME timerfd, so an alarm ends the
+ *  wait at once. Only chips whose driver is known to notify (chip->notify,
+ *  the LM90 family) are used, and only limits the driver made writable.
+ *  The others (applesmc, coretemp, ...) are left to the regular cycle. Old
+ *  limits are restored on exit.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <limits.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include "config.h"
+#include "control.h"
+#include "probes.h"
+#include "alarm.h"
+
+//------------------------------------------------------------------------------
+
+#define MAX_ALARMS		32
+#define ALARM_HOLDOFF	1		// seconds, at most one alarm wakeup per
+
+struct alarm
+{
+	struct sensor *sensor;
+	int fd;					// tempN_*_alarm, read to rearm
+	char limit[PATH_MAX + 16];	// tempN_max or tempN_crit
+	int saved;				// limit before we wrote it, millidegrees
+	int crit;
+	int gone;				// chip unbound, attribute can't be read
+};
+
+static struct alarm alarms[MAX_ALARMS];
+static int alarm_count = 0;
+static struct profile *armed = NULL;	// profile the limits were written for
+static int timer = -1;
+static double last_alarm = -ALARM_HOLDOFF;
+
+unsigned long alarm_wakeups = 0;
+
+//------------------------------------------------------------------------------
+// ceiling of the source a sensor feeds, 0 if none
+
+static float sensor_limit(struct sensor *s, struct profile *p)
+{
+	if(s == sensor_TC0P)
+	{
+		return p->temp_TC0P_ceiling;
+	}
+	if(s == sensor_TG0P)
+	{
+		return p->temp_TG0P_ceiling;
+	}
+	if(s->in_avg && s->weight > 0)
+	{
+		return p->temp_avg_ceiling;
+	}
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+// reading the attribute rearms the notification, returns its value, -1 if
+// it can't be read
+
+static int rearm(int fd)
+{
+	char buf[8];
+
+	lseek(fd, 0, SEEK_SET);
+	int n = read(fd, buf, sizeof(buf) - 1);
+
+	if(n <= 0)
+	{
+		return -1;
+	}
+
+	return buf[0] == '1';
+}
+
+//------------------------------------------------------------------------------
+
+static void watch(struct sensor *s, char *limit, int crit, int val)
+{
+	char base[PATH_MAX];
+	char fname[PATH_MAX + 32];
+	struct stat buf;
+	int saved;
+
+	if(alarm_count >= MAX_ALARMS || ! s->chip->notify)
+	{
+		return;
+	}
+
+	// tempN_input -> tempN
+
+	snprintf(base, sizeof(base), "%s", s->fname);
+	char *p = strrchr(base, '_');
+	if(p != NULL)
+	{
+		*p = 0;
+	}
+
+	struct alarm *a = &alarms[alarm_count];
+
+	snprintf(a->limit, sizeof(a->limit), "%s_%s", base, limit);
+	snprintf(fname, sizeof(fname), "%s_%s_alarm", base, limit);
+
+	// access() passes for root, the mode tells a read-only limit
+
+	if(stat(a->limit, &buf) != 0 || ! (buf.st_mode & S_IWUSR) || read_attr(a->limit, &saved) != 0)
+	{
+		return;
+	}
+
+	a->fd = open(fname, O_RDONLY | O_CLOEXEC);
+	if(a->fd < 0)
+	{
+		return;
+	}
+
+	if(write_attr(a->limit, val) != 0)
+	{
+		close(a->fd);
+		return;
+	}
+
+	rearm(a->fd);
+
+	a->sensor = s;
+	a->saved = saved;
+	a->crit = crit;
+	a->gone = 0;
+	++alarm_count;
+}
+
+//------------------------------------------------------------------------------
+
+void alarm_open()
+{
+	int i;
+
+	alarm_close();
+
+	if(! temp_alarm || profile == NULL)
+	{
+		return;
+	}
+
+	for(i = 0; i < sensor_count; ++i)
+	{
+		struct sensor *s = &sensors[i];
+		float limit = sensor_limit(s, profile);
+
+		if(s->excluded)
+		{
+			continue;
+		}
+
+		if(limit > 0)
+		{
+			watch(s, "max", 0, (int)(limit * 1000));
+		}
+
+		if(temp_crit > 0)
+		{
+			watch(s, "crit", 1, temp_crit * 1000);
+		}
+	}
+
+	armed = profile;
+
+	if(alarm_count > 0 && timer < 0)
+	{
+		timer = timerfd_create(CLOCK_BOOTTIME, TFD_CLOEXEC);
+	}
+
+	if(alarm_count > 0 && timer > -1)
+	{
+		printf("Watching %d temperature alarms.\n", alarm_count);
+	}
+	else
+	{
+		printf("No temperature alarms, polling only.\n");
+	}
+	fflush(stdout);
+}
+
+//------------------------------------------------------------------------------
+
+void alarm_profile()
+{
+	int i;
+
+	if(armed == NULL || armed == profile)
+	{
+		return;
+	}
+
+	for(i = 0; i < alarm_count; ++i)
+	{
+		float limit = sensor_limit(alarms[i].sensor, profile);
+
+		if(! alarms[i].crit && ! alarms[i].gone && limit > 0)
+		{
+			write_attr(alarms[i].limit, (int)(limit * 1000));
+		}
+	}
+
+	armed = profile;
+}
+
+//------------------------------------------------------------------------------
+
+int alarm_wait(struct timespec *until)
+{
+	struct pollfd fds[MAX_ALARMS + 1];
+	struct itimerspec its;
+	int i;
+
+	if(alarm_count == 0 || timer < 0)
+	{
+		return -1;
+	}
+
+	// an alarm that keeps firing must not turn into a busy loop
+
+	double now = get_time();
+	if(now - last_alarm < ALARM_HOLDOFF)
+	{
+		struct timespec ts = {0, (long)((ALARM_HOLDOFF - (now - last_alarm)) * 1e9)};
+		nanosleep(&ts, NULL);
+	}
+
+	memset(&its, 0, sizeof(its));
+	its.it_value = *until;
+
+	if(timerfd_settime(timer, TFD_TIMER_ABSTIME, &its, NULL) != 0)
+	{
+		return -1;
+	}
+
+	fds[0].fd = timer;
+	fds[0].events = POLLIN;
+
+	for(i = 0; i < alarm_count; ++i)
+	{
+		fds[i + 1].fd = alarms[i].gone ? -1 : alarms[i].fd;	// negative is skipped
+		fds[i + 1].events = POLLPRI | POLLERR;
+	}
+
+	for(;;)
+	{
+		if(poll(fds, alarm_count + 1, -1) < 0)
+		{
+			return 0;		// signal, handled by the main loop
+		}
+
+		if(fds[0].revents & POLLIN)
+		{
+			uint64_t expired;
+			read(timer, &expired, sizeof(expired));
+			return 0;
+		}
+
+		// notified on set and on clear, only a raised alarm wakes the loop
+
+		int fired = 0;
+
+		for(i = 0; i < alarm_count; ++i)
+		{
+			if(! fds[i + 1].revents)
+			{
+				continue;
+			}
+
+			int raised = rearm(alarms[i].fd);
+
+			// an unbound chip reports POLLERR | POLLPRI for good, left to the
+			// rescan following its removal
+
+			if(raised < 0)
+			{
+				alarms[i].gone = 1;
+				fds[i + 1].fd = -1;
+				continue;
+			}
+
+			if(raised)
+			{
+				struct sensor *s = alarms[i].sensor;
+				int val = 0;
+
+				read_attr(s->fname, &val);
+				printf("Temperature %s alarm, %s %s %.1fC\n", alarms[i].crit ? "crit" : "max",
+					   s->chip->name, s->name, val / 1000.0);
+				PROBE2(temp_alarm, s->id, alarms[i].crit);
+				fired = 1;
+			}
+		}
+
+		if(fired)
+		{
+			last_alarm = get_time();
+			++alarm_wakeups;
+			fflush(stdout);
+			return 1;
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+
+void alarm_close()
+{
+	int i;
+
+	for(i = 0; i < alarm_count; ++i)
+	{
+		if(! alarms[i].gone)
+		{
+			write_attr(alarms[i].limit, alarms[i].saved);
+		}
+		close(alarms[i].fd);
+	}
+
+	alarm_count = 0;
+	armed = NULL;
+}
+
+//------------------------------------------------------------------------------
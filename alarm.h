@@ -0,0 +1,29 @@
+/*
+ *  alarm.h -  Fan control daemon for MacBook
+ *
+ *  Copyright (C) 2010  Mikael Strom <mikael@sesamiq.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ */
+
+#ifndef ALARM_H_
+#define ALARM_H_
+
+#include <time.h>
+
+extern unsigned long alarm_wakeups;
+
+void alarm_open();		// after scan_sensors() and rediscover()
+void alarm_profile();	// every cycle, reprograms the limits when the profile changed
+int alarm_wait(struct timespec *until);	// CLOCK_BOOTTIME, 1 on alarm, 0 on timeout, -1 if not watching
+void alarm_close();		// restores the limits
+
+#endif /* ALARM_H_ */
@@ -0,0 +1,441 @@
+/*
+ *  autotune.c -  Fan control daemon for MacBook
+ *
+ *  Copyright (C) 2010  Mikael Strom <mikael@sesamiq.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  Thermal identification. With every CPU busy and the fans held at
+ *  TUNE_LOW, the sources are left to settle, then the fans are stepped to
+ *  TUNE_HIGH through set_fan(). Each source's response is fitted to a first
+ *  order plus dead time model (gain, time constant, dead time) by the two
+ *  point method, 28% and 63% of the step. From the model, SIMC rules give
+ *  PI gains and the ramp slope, written to a config fragment.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include "config.h"
+#include "control.h"
+#include "hwmon.h"
+#include "autotune.h"
+
+//------------------------------------------------------------------------------
+
+#define TUNE_LOW		2000	// rpm
+#define TUNE_HIGH		5000
+#define TUNE_MAX_TIME	900		// seconds per phase
+#define TUNE_SETTLE		60		// settled when no source moved more than
+#define TUNE_SETTLE_C	0.5		// this in the last TUNE_SETTLE seconds
+#define TUNE_ABORT_C	90		// too hot, give up
+#define TUNE_AVG		10		// samples averaged for start and end values
+#define MAX_BURNERS		64
+
+struct response
+{
+	float temp[TUNE_MAX_TIME];
+	int n;
+	float start;				// settled value before the step
+	float end;
+	float gain;					// degrees per rpm, negative
+	float tau;					// seconds
+	float dead;					// seconds
+	int valid;
+};
+
+static struct response resp[CTL_TG0P + 1];
+
+static void real_wait(int seconds);
+static void burn(int on);
+
+void (*tune_wait)(int seconds) = real_wait;
+void (*tune_load)(int on) = burn;
+
+static pid_t burners[MAX_BURNERS];
+static int burner_count = 0;
+
+static int *run;				// cleared by SIGINT / SIGTERM
+
+//------------------------------------------------------------------------------
+
+static void real_wait(int seconds)
+{
+	struct timespec ts = {seconds, 0};
+
+	while(nanosleep(&ts, &ts) != 0 && *run)
+		;
+}
+
+//------------------------------------------------------------------------------
+// one busy child per CPU, killed when done. The children don't share the
+// parent's signal handler and die with it, none is left spinning.
+
+static void burn(int on)
+{
+	int i;
+
+	if(on)
+	{
+		int cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		pid_t parent = getpid();
+
+		for(i = 0; i < cpus && burner_count < MAX_BURNERS; ++i)
+		{
+			pid_t pid = fork();
+
+			if(pid == 0)
+			{
+				signal(SIGINT, SIG_DFL);
+				signal(SIGTERM, SIG_DFL);
+				prctl(PR_SET_PDEATHSIG, SIGKILL);
+
+				if(getppid() != parent)
+				{
+					_exit(0);		// parent died before prctl()
+				}
+
+				volatile unsigned long spin = 0;
+				for(;;)
+				{
+					++spin;
+				}
+			}
+			else if(pid > 0)
+			{
+				burners[burner_count++] = pid;
+			}
+		}
+	}
+	else
+	{
+		for(i = 0; i < burner_count; ++i)
+		{
+			kill(burners[i], SIGKILL);
+			waitpid(burners[i], NULL, 0);
+		}
+		burner_count = 0;
+	}
+}
+
+//------------------------------------------------------------------------------
+
+static float source_temp(int ctl)
+{
+	switch(ctl)
+	{
+	case CTL_TC0P:
+		return sensor_TC0P != NULL ? sensor_TC0P->value : 0;
+	case CTL_TG0P:
+		return sensor_TG0P != NULL ? sensor_TG0P->value : 0;
+	}
+	return temp_avg;
+}
+
+//------------------------------------------------------------------------------
+
+static int source_present(int ctl)
+{
+	return ctl == CTL_AVG || (ctl == CTL_TC0P && sensor_TC0P != NULL) ||
+		   (ctl == CTL_TG0P && sensor_TG0P != NULL);
+}
+
+//------------------------------------------------------------------------------
+
+static float mean(float *v, int n)
+{
+	float sum = 0;
+	int i;
+
+	for(i = 0; i < n; ++i)
+	{
+		sum += v[i];
+	}
+
+	return n > 0 ? sum / n : 0;
+}
+
+//------------------------------------------------------------------------------
+// sample every second at the given fan speed until all sources settle.
+// Samples go to resp[].temp if record is set. Returns -1 if too hot or
+// interrupted.
+
+static int hold(int rpm, int record)
+{
+	float first[CTL_TG0P + 1][TUNE_MAX_TIME];
+	int t;
+	int c;
+
+	fan_speed = rpm;
+
+	for(t = 0; t < TUNE_MAX_TIME; ++t)
+	{
+		if(! *run)
+		{
+			printf("Autotune: interrupted, aborting\n");
+			return -1;
+		}
+
+		read_sensors();		// calc_avg() included
+		set_fan();
+
+		int settled = t >= TUNE_SETTLE;
+
+		for(c = CTL_AVG; c <= CTL_TG0P; ++c)
+		{
+			float temp = source_temp(c);
+
+			if(! source_present(c))
+			{
+				continue;
+			}
+
+			if(temp > TUNE_ABORT_C)
+			{
+				printf("Error: %s at %.1fC, aborting\n", ctl_name(c), temp);
+				return -1;
+			}
+
+			first[c][t] = temp;
+			if(record)
+			{
+				resp[c].temp[t] = temp;
+				resp[c].n = t + 1;
+			}
+
+			if(t >= TUNE_SETTLE)
+			{
+				float d = temp - first[c][t - TUNE_SETTLE];
+				settled &= d < TUNE_SETTLE_C && d > -TUNE_SETTLE_C;
+			}
+		}
+
+		if(t % 30 == 0)
+		{
+			printf("\t%4ds  %4d rpm  AVG %.1fC", t, rpm, temp_avg);
+			if(sensor_TC0P != NULL)
+			{
+				printf("  TC0P %.1fC", sensor_TC0P->value);
+			}
+			if(sensor_TG0P != NULL)
+			{
+				printf("  TG0P %.1fC", sensor_TG0P->value);
+			}
+			printf("\n");
+			fflush(stdout);
+		}
+
+		if(settled)
+		{
+			break;
+		}
+
+		tune_wait(1);
+	}
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+// first time the response has covered frac of the step
+
+static float crossing(struct response *r, float frac)
+{
+	int t;
+
+	for(t = 0; t < r->n; ++t)
+	{
+		if((r->temp[t] - r->start) / (r->end - r->start) >= frac)
+		{
+			return t;
+		}
+	}
+
+	return r->n;
+}
+
+//------------------------------------------------------------------------------
+
+static void fit(struct response *r, float before)
+{
+	int n = min(TUNE_AVG, r->n);
+
+	r->start = before;
+	r->end = mean(r->temp + r->n - n, n);
+	r->valid = 0;
+
+	if(r->end - r->start > -1)
+	{
+		return;		// less than a degree, no usable response
+	}
+
+	float t28 = crossing(r, 0.283);
+	float t63 = crossing(r, 0.632);
+
+	r->gain = (r->end - r->start) / (TUNE_HIGH - TUNE_LOW);
+	r->tau = max(1, 1.5 * (t63 - t28));
+	r->dead = max(0, t63 - r->tau);
+	r->valid = 1;
+}
+
+//------------------------------------------------------------------------------
+
+int autotune(char *fragment, int *running)
+{
+	float before[CTL_TG0P + 1];
+	int poll_div[MAX_CHIPS];
+	int c;
+
+	memset(resp, 0, sizeof(resp));
+	run = running;
+
+	// a hot CPU sensor dropping in and out of temp_avg would be read as
+	// a response, the step needs a fixed set of sensors. smc_poll would
+	// turn the 1s samples into a staircase, every chip is read each time.
+
+	float outlier = temp_outlier;
+	temp_outlier = 0;
+
+	for(c = 0; c < chip_count; ++c)
+	{
+		poll_div[c] = chips[c].poll_div;
+		chips[c].poll_div = 1;
+	}
+
+	printf("Autotune: load on, fans at %d rpm until settled...\n", TUNE_LOW);
+	fflush(stdout);
+
+	tune_load(1);
+
+	int ret = hold(TUNE_LOW, 0);
+
+	if(ret == 0)
+	{
+		for(c = CTL_AVG; c <= CTL_TG0P; ++c)
+		{
+			before[c] = source_temp(c);
+		}
+
+		printf("Autotune: fans stepped to %d rpm...\n", TUNE_HIGH);
+		ret = hold(TUNE_HIGH, 1);
+	}
+
+	tune_load(0);
+	temp_outlier = outlier;
+
+	for(c = 0; c < chip_count; ++c)
+	{
+		chips[c].poll_div = poll_div[c];
+	}
+
+	// back to the configured minimum, the SMC controls the fans above it.
+	// Left at max when too hot.
+
+	fan_speed = ret == 0 || ! *run ? profile->fan_min : fan_max;
+	set_fan();
+
+	if(ret != 0)
+	{
+		return -1;
+	}
+
+	// SIMC PI rules on the slowest, most sensitive loop. The control period
+	// adds half a period of dead time, closed loop time constant = dead time
+
+	float kc = 0;
+	float ti = 0;
+
+	for(c = CTL_AVG; c <= CTL_TG0P; ++c)
+	{
+		struct response *r = &resp[c];
+
+		if(! source_present(c))
+		{
+			continue;
+		}
+
+		fit(r, before[c]);
+
+		if(! r->valid)
+		{
+			printf("Autotune: %s didn't respond to the fan step\n", ctl_name(c));
+			continue;
+		}
+
+		printf("Autotune: %s %.1fC -> %.1fC, gain %.5f C/rpm, time constant %.0fs, dead time %.0fs\n",
+			   ctl_name(c), r->start, r->end, r->gain, r->tau, r->dead);
+
+		float dead = r->dead + 2.5;
+		float k = r->tau / (-r->gain * 2 * dead);
+
+		if(kc == 0 || k < kc)
+		{
+			kc = k;
+			ti = min(r->tau, 8 * dead);
+		}
+	}
+
+	if(kc == 0)
+	{
+		printf("Error: No source responded, nothing to tune\n");
+		return -1;
+	}
+
+	// write the fragment
+
+	FILE *fp = fopen(fragment, "w");
+	if(fp == NULL)
+	{
+		printf("Error: Can't create %s\n", fragment);
+		return -1;
+	}
+
+	fprintf(fp, "# macfanctld --autotune, fans stepped %d -> %d rpm at full load\n", TUNE_LOW, TUNE_HIGH);
+
+	for(c = CTL_AVG; c <= CTL_TG0P; ++c)
+	{
+		if(resp[c].valid)
+		{
+			fprintf(fp, "# %s: %.1fC -> %.1fC, gain %.5f C/rpm, time constant %.0fs, dead time %.0fs\n",
+					ctl_name(c), resp[c].start, resp[c].end, resp[c].gain, resp[c].tau, resp[c].dead);
+		}
+	}
+
+	// ramps with the PI gain as slope, ending at the configured ceilings
+
+	float span = (fan_max - profile->fan_min) / kc;
+
+	span = min(span, 30);
+	span = max(span, 2);
+
+	fprintf(fp, "\n");
+	fprintf(fp, "temp_avg_floor: %.0f\n", max(0, profile->temp_avg_ceiling - span));
+	fprintf(fp, "temp_TC0P_floor: %.0f\n", max(0, profile->temp_TC0P_ceiling - span));
+	fprintf(fp, "temp_TG0P_floor: %.0f\n", max(0, profile->temp_TG0P_ceiling - span));
+	fprintf(fp, "\n");
+	fprintf(fp, "pid_kp: %.0f\n", kc);
+	fprintf(fp, "pid_ki: %.1f\n", kc / ti);
+	fprintf(fp, "pid_kd: 0\n");
+
+	fclose(fp);
+
+	printf("Autotune: wrote %s\n", fragment);
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------
@@ -0,0 +1,25 @@
+/*
+ *  autotune.h -  Fan control daemon for MacBook
+ *
+ *  Copyright (C) 2010  Mikael Strom <mikael@sesamiq.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ */
+
+#ifndef AUTOTUNE_H_
+#define AUTOTUNE_H_
+
+extern void (*tune_wait)(int seconds);	// replaced by the simulator
+extern void (*tune_load)(int on);		// CPU load on / off
+
+int autotune(char *fragment, int *running);	// after scan_sensors(), stops when *running is cleared, returns 0 on success
+
+#endif /* AUTOTUNE_H_ */
@@ -19,24 +19,97 @@
 #include <string.h>
 #include <ctype.h>
 #include "config.h"
+#include "control.h"
 
 //-----------------------------------------------------------------------------
 
 static FILE *fp;
 
-float temp_avg_floor = 40;		// default values if no config file is found
-float temp_avg_ceiling = 50;
+static char cur_section[PROFILE_NAME_MAXLEN];	// section of the last line read
+static char *want_section = "";					// read params from, "" is top level
 
-float temp_TC0P_floor = 40;
-float temp_TC0P_ceiling = 50;
+struct profile profiles[MAX_PROFILES] =
+{
+	{"default", 40, 50, 40, 50, 40, 50, 0}		// default values if no config file is found
+};
+int profile_count = 1;
 
-float temp_TG0P_floor = 40;
-float temp_TG0P_ceiling = 50;
+struct profile *profile = &profiles[0];			// active profile
+struct profile *profile_ac = NULL;				// automatic selection, NULL is default
+struct profile *profile_battery = NULL;
+struct profile *profile_forced = NULL;			// manual override
 
-float fan_min = 0;
 float fan_max = 6200;			// fixed max value
 
 int log_level = 0;
+float log_delta = 1;
+int log_heartbeat = 300;
+int log_flush = 30;
+int log_syslog = 0;
+
+int fan_tolerance = 150;
+int fan_fb_cycles = 3;
+int fan_correct = 1;
+int fan_correct_max = 500;
+int fan_stall_rpm = 500;
+
+int fan_slew_up = 0;
+int fan_slew_down = 200;
+float temp_avg_hyst = 1;
+float temp_TC0P_hyst = 1;
+float temp_TG0P_hyst = 1;
+
+int fan_mode = MODE_RAMP;
+float pid_target = 62;
+int pid_sources = 1 << CTL_TC0P;
+float pid_kp = 400;
+float pid_ki = 20;
+float pid_kd = 0;
+float pid_d_filter = 10;
+
+int fan_optimize = 0;
+float fan_power = 1.5;
+int optimize_step = 200;
+int optimize_dwell = 60;
+float optimize_margin = 2;
+
+char *fan_mode_names[] = {"ramp", "pid"};
+
+int temp_avg_mode = AVG_MEAN;
+int temp_avg_trim = 20;
+float temp_outlier = 0;
+
+char *avg_mode_names[] = {"mean", "trimmed", "median", "max"};
+#define N_AVG_MODES		(sizeof(avg_mode_names) / sizeof(avg_mode_names[0]))
+
+struct
+{
+	char label[WEIGHT_LABEL_MAXLEN];
+	float weight;
+}
+avg_weights[MAX_WEIGHTS];
+int avg_weight_count = 0;
+
+char bind_TC0P[BIND_MAXLEN] = "TC0P";
+char bind_TG0P[BIND_MAXLEN] = "TG0P";
+int smc_poll = 1;
+
+char metrics_file[PATH_MAX] = "";
+int metrics_interval = 15;
+
+unsigned long config_reloads = 0;
+
+int stats_interval = 0;
+
+int temp_alarm = 0;
+int temp_crit = 0;
+
+char shadow_cfg[PATH_MAX] = "";
+
+int cpufreq_cap = 0;
+int cpufreq_step = 5;
+int cpufreq_floor = 60;
+int cpufreq_hyst = 3;
 
 int exclude[MAX_EXCLUDE];		// array of sensors to exclude
 
@@ -94,25 +167,44 @@ int get_val(char *buf)
 }
 
 //-----------------------------------------------------------------------------
-// format is: name : integer
 
-int read_param(char* name, int min_val, int max_val, int def)
+static void rewind_cfg()
 {
 	fseek(fp, 0, SEEK_SET);
+	cur_section[0] = 0;
+}
+
+//-----------------------------------------------------------------------------
+// get next "name : value" line in want_section, terminated at the colon
+// returns the value part, NULL when no more to read
 
-	while(1)
+static char *next_param(char *buf, int size)
+{
+	while(fgets(buf, size, fp) != NULL)
 	{
-		char buf[64];
-		char *s = fgets(buf, sizeof(buf), fp);
+		if(buf[0] == '#' || buf[0] == '\n')
+		{
+			continue;					// skip comments
+		}
 
-		if(s == NULL)
+		if(buf[0] == '[')				// profile section: [name]
 		{
-			break;						// exit when no more to read
+			char *end = strchr(buf, ']');
+			if(end == NULL)
+			{
+				printf("Ill formed line in config file: %s\n", buf);
+				continue;
+			}
+
+			*end = 0;
+			strncpy(cur_section, buf + 1, sizeof(cur_section) - 1);
+			cur_section[sizeof(cur_section) - 1] = 0;
+			continue;
 		}
 
-		if(buf[0] == '#' || buf[0] == '\n')
+		if(strcmp(cur_section, want_section) != 0)
 		{
-			continue;					// skip comments
+			continue;					// not our section
 		}
 
 		char *colon = strchr(buf, ':');	// find colon
@@ -124,9 +216,27 @@ int read_param(char* name, int min_val, int max_val, int def)
 
 		*colon = 0;						// terminate string at colon
 
+		return colon + 1;
+	}
+
+	return NULL;						// exit when no more to read
+}
+
+//-----------------------------------------------------------------------------
+// format is: name : integer
+
+int read_param(char* name, int min_val, int max_val, int def)
+{
+	char buf[256];
+	char *value;
+
+	rewind_cfg();
+
+	while((value = next_param(buf, sizeof(buf))) != NULL)
+	{
 		if(match(name, buf))
 		{
-			int val = get_val(colon + 1);	// get value
+			int val = get_val(value);	// get value
 
 			if(val < 0)
 			{
@@ -146,40 +256,86 @@ int read_param(char* name, int min_val, int max_val, int def)
 }
 
 //-----------------------------------------------------------------------------
-// format is: exclude : integer {integer}
+// format is: name : string
 
-void read_exclude_list()
+void read_str_param(char* name, char* val, int size, char* def)
 {
-	fseek(fp, 0, SEEK_SET);
+	char buf[256];
+	char *value;
 
-	while(1)
-	{
-		char buf[256];
-		char *s = fgets(buf, sizeof(buf), fp);
+	strncpy(val, def, size - 1);
+	val[size - 1] = 0;
 
-		if(s == NULL)
-		{
-			break;						// exit when no more to read
-		}
+	rewind_cfg();
 
-		if(buf[0] == '#' || buf[0] == '\n')
+	while((value = next_param(buf, sizeof(buf))) != NULL)
+	{
+		if(match(name, buf))
 		{
-			continue;					// skip comments
-		}
+			char *start = value;
+			char *end;
 
-		char *colon = strchr(buf, ':');	// find colon
-		if(colon == NULL)
-		{
-			printf("Ill formed line in config file: %s\n", buf);
-			continue;
+			while(isspace(*start))		// trim ws at both ends
+			{
+				++start;
+			}
+
+			end = start + strlen(start);
+			while(end > start && isspace(*(end - 1)))
+			{
+				--end;
+			}
+			*end = 0;
+
+			if(*start == 0)
+			{
+				continue;				// empty, keep default
+			}
+
+			strncpy(val, start, size - 1);
+			val[size - 1] = 0;
+			return;
 		}
+	}
+}
 
-		*colon = 0;						// terminate string at colon
+//-----------------------------------------------------------------------------
+// format is: name : number
 
+float read_fparam(char* name, float min_val, float max_val, float def)
+{
+	char buf[32];
+
+	read_str_param(name, buf, sizeof(buf), "");
+
+	if(buf[0] == 0)
+	{
+		return def;
+	}
+
+	float val = atof(buf);
+
+	val = min(max_val, val);			// clamp
+	val = max(min_val, val);
+	return val;
+}
+
+//-----------------------------------------------------------------------------
+// format is: exclude : integer {integer}
+
+void read_exclude_list()
+{
+	char buf[256];
+	char *value;
+
+	rewind_cfg();
+
+	while((value = next_param(buf, sizeof(buf))) != NULL)
+	{
 		if(match("exclude", buf))
 		{
 			int i;
-			char* values = colon + 1;
+			char* values = value;
 		
 			// get values
 
@@ -221,50 +377,442 @@ void read_exclude_list()
 	}
 }
  
+//-----------------------------------------------------------------------------
+// precalculate fan rpm per degree above floor for each source
+
+static void compile_profile(struct profile *p)
+{
+	float fan_window = fan_max - p->fan_min;
+
+	p->avg_slope = fan_window / (p->temp_avg_ceiling - p->temp_avg_floor);
+	p->TC0P_slope = fan_window / (p->temp_TC0P_ceiling - p->temp_TC0P_floor);
+	p->TG0P_slope = fan_window / (p->temp_TG0P_ceiling - p->temp_TG0P_floor);
+}
+
+//-----------------------------------------------------------------------------
+// params not given in want_section are taken from base
+
+static void read_profile(struct profile *p, struct profile *base)
+{
+	p->temp_avg_ceiling = read_param("temp_avg_ceiling",	0, 90, base->temp_avg_ceiling);
+	p->temp_avg_floor = read_param("temp_avg_floor", 		0, p->temp_avg_ceiling - 1,
+								   min(base->temp_avg_floor, p->temp_avg_ceiling - 1));
+
+	p->temp_TC0P_ceiling = read_param("temp_TC0P_ceiling",	0, 90, base->temp_TC0P_ceiling);
+	p->temp_TC0P_floor = read_param("temp_TC0P_floor",		0, p->temp_TC0P_ceiling - 1,
+									min(base->temp_TC0P_floor, p->temp_TC0P_ceiling - 1));
+
+	p->temp_TG0P_ceiling = read_param("temp_TG0P_ceiling",	0, 90, base->temp_TG0P_ceiling);
+	p->temp_TG0P_floor = read_param("temp_TG0P_floor",		0, p->temp_TG0P_ceiling - 1,
+									min(base->temp_TG0P_floor, p->temp_TG0P_ceiling - 1));
+
+	p->fan_min = read_param("fan_min", 0, 6200, base->fan_min);
+
+	compile_profile(p);
+}
+
+//-----------------------------------------------------------------------------
+
+struct profile *find_profile(char *name)
+{
+	int i;
+
+	for(i = 0; i < profile_count; ++i)
+	{
+		if(strcmp(profiles[i].name, name) == 0)
+		{
+			return &profiles[i];
+		}
+	}
+
+	return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// top level params make up the default profile, each [name] section
+// is a profile overriding some of them
+
+static void read_profiles()
+{
+	struct profile file_defaults = {"default", 40, 50, 50, 65, 65, 80, 0};
+	char names[MAX_PROFILES][PROFILE_NAME_MAXLEN];
+	char buf[256];
+	int n = 0;
+	int i;
+
+	want_section = "";
+	read_profile(&profiles[0], &file_defaults);
+	profile_count = 1;
+
+	// collect section names
+
+	fseek(fp, 0, SEEK_SET);
+
+	while(fgets(buf, sizeof(buf), fp) != NULL && n < MAX_PROFILES - 1)
+	{
+		char *end = strchr(buf, ']');
+
+		if(buf[0] == '[' && end != NULL)
+		{
+			*end = 0;
+			strncpy(names[n], buf + 1, PROFILE_NAME_MAXLEN - 1);
+			names[n][PROFILE_NAME_MAXLEN - 1] = 0;
+
+			for(i = 0; i < n && strcmp(names[i], names[n]) != 0; ++i)
+				;
+
+			if(i == n && strcmp(names[n], "default") != 0)
+			{
+				++n;		// new name
+			}
+		}
+	}
+
+	for(i = 0; i < n; ++i)
+	{
+		struct profile *p = &profiles[profile_count++];
+
+		strcpy(p->name, names[i]);
+		want_section = p->name;
+		read_profile(p, &profiles[0]);
+	}
+
+	want_section = "";
+}
+
+//-----------------------------------------------------------------------------
+
+static struct profile *read_profile_name(char *param)
+{
+	char name[PROFILE_NAME_MAXLEN];
+	struct profile *p;
+
+	read_str_param(param, name, sizeof(name), "");
+
+	if(name[0] == 0)
+	{
+		return NULL;
+	}
+
+	p = find_profile(name);
+	if(p == NULL)
+	{
+		printf("Unknown profile in config file: %s: %s\n", param, name);
+	}
+
+	return p;
+}
+
+//-----------------------------------------------------------------------------
+
+static void read_fan_mode()
+{
+	char mode[16];
+
+	read_str_param("fan_mode", mode, sizeof(mode), "ramp");
+
+	if(strcmp(mode, "pid") == 0)
+	{
+		fan_mode = MODE_PID;
+	}
+	else
+	{
+		if(strcmp(mode, "ramp") != 0)
+		{
+			printf("Unknown fan_mode in config file: %s\n", mode);
+		}
+		fan_mode = MODE_RAMP;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// format is: pid_sources: TC0P TG0P
+
+static void read_pid_sources()
+{
+	char buf[64];
+	char *name;
+	int i;
+
+	read_str_param("pid_sources", buf, sizeof(buf), "TC0P");
+
+	pid_sources = 0;
+
+	for(name = strtok(buf, " \t"); name != NULL; name = strtok(NULL, " \t"))
+	{
+		for(i = CTL_AVG; i <= CTL_TG0P && strcmp(name, ctl_name(i)) != 0; ++i)
+			;
+
+		if(i <= CTL_TG0P)
+		{
+			pid_sources |= 1 << i;
+		}
+		else
+		{
+			printf("Unknown source in pid_sources: %s\n", name);
+		}
+	}
+
+	if(pid_sources == 0)
+	{
+		pid_sources = 1 << CTL_TC0P;
+	}
+}
+
+//-----------------------------------------------------------------------------
+
+static void read_avg_mode()
+{
+	char mode[16];
+	int i;
+
+	read_str_param("temp_avg_mode", mode, sizeof(mode), "mean");
+
+	for(i = 0; i < N_AVG_MODES; ++i)
+	{
+		if(strcmp(mode, avg_mode_names[i]) == 0)
+		{
+			temp_avg_mode = i;
+			return;
+		}
+	}
+
+	printf("Unknown temp_avg_mode in config file: %s\n", mode);
+	temp_avg_mode = AVG_MEAN;
+}
+
+//-----------------------------------------------------------------------------
+// format is: temp_avg_weights: label weight label weight ...
+
+static void read_avg_weights()
+{
+	char buf[256];
+	char *p = buf;
+	int n;
+
+	avg_weight_count = 0;
+
+	read_str_param("temp_avg_weights", buf, sizeof(buf), "");
+
+	while(avg_weight_count < MAX_WEIGHTS)
+	{
+		char label[WEIGHT_LABEL_MAXLEN];
+		float weight;
+
+		if(sscanf(p, "%23s %f%n", label, &weight, &n) != 2)
+		{
+			break;
+		}
+
+		if(weight < 0 || weight > 10)
+		{
+			printf("Bad weight in config file: %s %.1f\n", label, weight);
+		}
+		else
+		{
+			strcpy(avg_weights[avg_weight_count].label, label);
+			avg_weights[avg_weight_count].weight = weight;
+			++avg_weight_count;
+		}
+
+		p += n;
+	}
+}
+
+//-----------------------------------------------------------------------------
+
+float avg_weight(char *label)
+{
+	int i;
+
+	for(i = 0; i < avg_weight_count; ++i)
+	{
+		if(strcmp(avg_weights[i].label, label) == 0)
+		{
+			return avg_weights[i].weight;
+		}
+	}
+
+	return 1;
+}
+
 //-----------------------------------------------------------------------------
 
 void read_cfg(char* name)
 {
+	int i;
+
 	memset(exclude, 0, sizeof(exclude));
+	avg_weight_count = 0;
+
+	profile_ac = NULL;
+	profile_battery = NULL;
+	profile_forced = NULL;
 
 	fp = fopen(name, "r");
 
 	if(fp != NULL)
 	{
-		temp_avg_ceiling = read_param("temp_avg_ceiling",	0, 90, 50);
-		temp_avg_floor = read_param("temp_avg_floor", 		0, temp_avg_ceiling - 1, 40);
-
-		temp_TC0P_ceiling = read_param("temp_TC0P_ceiling",	0, 90, 65);
-		temp_TC0P_floor = read_param("temp_TC0P_floor",		0, temp_TC0P_ceiling - 1, 50);
+		read_profiles();
 
-		temp_TG0P_ceiling = read_param("temp_TG0P_ceiling",	0, 90, 80);
-		temp_TG0P_floor = read_param("temp_TG0P_floor",		0, temp_TG0P_ceiling - 1, 65);
-
-		fan_min = read_param("fan_min", 0, 6200, 0);
+		profile_ac = read_profile_name("profile_ac");
+		profile_battery = read_profile_name("profile_battery");
+		profile_forced = read_profile_name("profile");
 
 		log_level = read_param("log_level", 0, 2, 0);
+		log_delta = read_fparam("log_delta", 0, 20, 1);
+		log_heartbeat = read_param("log_heartbeat", 5, 86400, 300);
+		log_flush = read_param("log_flush", 0, 3600, 30);
+		log_syslog = read_param("log_syslog", 0, 1, 0);
+
+		fan_tolerance = read_param("fan_tolerance", 10, 1000, 150);
+		fan_fb_cycles = read_param("fan_fb_cycles", 1, 20, 3);
+		fan_correct = read_param("fan_correct", 0, 1, 1);
+		fan_correct_max = read_param("fan_correct_max", 0, 2000, 500);
+		fan_stall_rpm = read_param("fan_stall_rpm", 0, 2000, 500);
+
+		fan_slew_up = read_param("fan_slew_up", 0, 10000, 0);
+		fan_slew_down = read_param("fan_slew_down", 0, 10000, 200);
+		temp_avg_hyst = read_fparam("temp_avg_hyst", 0, 10, 1);
+		temp_TC0P_hyst = read_fparam("temp_TC0P_hyst", 0, 10, 1);
+		temp_TG0P_hyst = read_fparam("temp_TG0P_hyst", 0, 10, 1);
+
+		read_fan_mode();
+		pid_target = read_fparam("pid_target", 30, 90, 62);
+		read_pid_sources();
+		pid_kp = read_fparam("pid_kp", 0, 5000, 400);
+		pid_ki = read_fparam("pid_ki", 0, 1000, 20);
+		pid_kd = read_fparam("pid_kd", 0, 50000, 0);
+		pid_d_filter = read_fparam("pid_d_filter", 0, 300, 10);
+
+		fan_optimize = read_param("fan_optimize", 0, 1, 0);
+		fan_power = read_fparam("fan_power", 0, 20, 1.5);
+		optimize_step = read_param("optimize_step", 50, 1000, 200);
+		optimize_dwell = read_param("optimize_dwell", 10, 600, 60);
+		optimize_margin = read_fparam("optimize_margin", 0, 20, 2);
+
+		read_avg_mode();
+		temp_avg_trim = read_param("temp_avg_trim", 0, 45, 20);
+		temp_outlier = read_fparam("temp_outlier", 0, 50, 0);
+		read_avg_weights();
+
+		cpufreq_cap = read_param("cpufreq_cap", 0, 1, 0);
+		cpufreq_step = read_param("cpufreq_step", 1, 25, 5);
+		cpufreq_floor = read_param("cpufreq_floor", 10, 100, 60);
+		cpufreq_hyst = read_param("cpufreq_hyst", 0, 20, 3);
 		
 		read_exclude_list();
 
+		read_str_param("bind_TC0P", bind_TC0P, sizeof(bind_TC0P), "TC0P");
+		read_str_param("bind_TG0P", bind_TG0P, sizeof(bind_TG0P), "TG0P");
+		smc_poll = read_param("smc_poll", 1, 12, 1);
+
+		read_str_param("metrics_file", metrics_file, sizeof(metrics_file), "");
+		metrics_interval = read_param("metrics_interval", 1, 3600, 15);
+
+		stats_interval = read_param("stats_interval", 0, 86400, 0);
+
+		temp_alarm = read_param("temp_alarm", 0, 1, 0);
+		temp_crit = read_param("temp_crit", 0, 110, 0);
+
+		read_str_param("shadow_cfg", shadow_cfg, sizeof(shadow_cfg), "");
+
 		fclose(fp);
 	}
 	else
 	{
 		printf("Could not open config file %s\n", name);
+		profile_count = 1;
+		compile_profile(&profiles[0]);
 	}
 
+	// active profile until the power source has been checked
+
+	profile = profile_forced != NULL ? profile_forced : &profiles[0];
+
 	printf("Using parameters:\n");
 
-	printf("\ttemp_avg_floor: %.0f\n", temp_avg_floor);
-	printf("\ttemp_avg_ceiling: %.0f\n", temp_avg_ceiling);
+	for(i = 0; i < profile_count; ++i)
+	{
+		struct profile *p = &profiles[i];
+
+		printf("\tprofile %s:\n", p->name);
 
-	printf("\ttemp_TC0P_floor: %.0f\n", temp_TC0P_floor);
-	printf("\ttemp_TC0P_ceiling: %.0f\n", temp_TC0P_ceiling);
+		printf("\t\ttemp_avg_floor: %.0f\n", p->temp_avg_floor);
+		printf("\t\ttemp_avg_ceiling: %.0f\n", p->temp_avg_ceiling);
 
-	printf("\ttemp_TG0P_floor: %.0f\n", temp_TG0P_floor);
-	printf("\ttemp_TG0P_ceiling: %.0f\n", temp_TG0P_ceiling);
+		printf("\t\ttemp_TC0P_floor: %.0f\n", p->temp_TC0P_floor);
+		printf("\t\ttemp_TC0P_ceiling: %.0f\n", p->temp_TC0P_ceiling);
 
-	printf("\tfan_min: %.0f\n", fan_min);
+		printf("\t\ttemp_TG0P_floor: %.0f\n", p->temp_TG0P_floor);
+		printf("\t\ttemp_TG0P_ceiling: %.0f\n", p->temp_TG0P_ceiling);
+
+		printf("\t\tfan_min: %.0f\n", p->fan_min);
+	}
+
+	printf("\tprofile_ac: %s\n", profile_ac != NULL ? profile_ac->name : "default");
+	printf("\tprofile_battery: %s\n", profile_battery != NULL ? profile_battery->name : "default");
+	if(profile_forced != NULL)
+	{
+		printf("\tprofile: %s\n", profile_forced->name);
+	}
+
+	printf("\tfan_tolerance: %d\n", fan_tolerance);
+	printf("\tfan_fb_cycles: %d\n", fan_fb_cycles);
+	printf("\tfan_correct: %d\n", fan_correct);
+	printf("\tfan_correct_max: %d\n", fan_correct_max);
+	printf("\tfan_stall_rpm: %d\n", fan_stall_rpm);
+
+	printf("\tfan_slew_up: %d\n", fan_slew_up);
+	printf("\tfan_slew_down: %d\n", fan_slew_down);
+	printf("\ttemp_avg_hyst: %.1f\n", temp_avg_hyst);
+	printf("\ttemp_TC0P_hyst: %.1f\n", temp_TC0P_hyst);
+	printf("\ttemp_TG0P_hyst: %.1f\n", temp_TG0P_hyst);
+
+	printf("\tfan_mode: %s\n", fan_mode_names[fan_mode]);
+	if(fan_mode == MODE_PID)
+	{
+		printf("\tpid_target: %.1f\n", pid_target);
+		printf("\tpid_sources:");
+		for(i = CTL_AVG; i <= CTL_TG0P; ++i)
+		{
+			if(pid_sources & (1 << i))
+			{
+				printf(" %s", ctl_name(i));
+			}
+		}
+		printf("\n");
+		printf("\tpid_kp: %.1f\n", pid_kp);
+		printf("\tpid_ki: %.2f\n", pid_ki);
+		printf("\tpid_kd: %.1f\n", pid_kd);
+		printf("\tpid_d_filter: %.1f\n", pid_d_filter);
+	}
+
+	printf("\tfan_optimize: %d\n", fan_optimize);
+	if(fan_optimize)
+	{
+		printf("\tfan_power: %.1f\n", fan_power);
+		printf("\toptimize_step: %d\n", optimize_step);
+		printf("\toptimize_dwell: %d\n", optimize_dwell);
+		printf("\toptimize_margin: %.1f\n", optimize_margin);
+	}
+
+	printf("\ttemp_avg_mode: %s\n", avg_mode_names[temp_avg_mode]);
+	if(temp_avg_mode == AVG_TRIMMED)
+	{
+		printf("\ttemp_avg_trim: %d\n", temp_avg_trim);
+	}
+	printf("\ttemp_outlier: %.1f\n", temp_outlier);
+
+	if(avg_weight_count > 0)
+	{
+		printf("\ttemp_avg_weights:");
+		for(i = 0; i < avg_weight_count; ++i)
+		{
+			printf(" %s %.1f", avg_weights[i].label, avg_weights[i].weight);
+		}
+		printf("\n");
+	}
 
 	if(exclude[0] != 0)
 	{
@@ -279,7 +827,75 @@ void read_cfg(char* name)
 		printf("\n");
 	}
 	
+	printf("\tbind_TC0P: %s\n", bind_TC0P);
+	printf("\tbind_TG0P: %s\n", bind_TG0P);
+	printf("\tsmc_poll: %d\n", smc_poll);
+
+	if(metrics_file[0] != 0)
+	{
+		printf("\tmetrics_file: %s\n", metrics_file);
+		printf("\tmetrics_interval: %d\n", metrics_interval);
+	}
+
+	if(stats_interval > 0)
+	{
+		printf("\tstats_interval: %d\n", stats_interval);
+	}
+
+	if(temp_alarm)
+	{
+		printf("\ttemp_alarm: %d\n", temp_alarm);
+		printf("\ttemp_crit: %d\n", temp_crit);
+	}
+
+	if(shadow_cfg[0] != 0)
+	{
+		printf("\tshadow_cfg: %s\n", shadow_cfg);
+	}
+
 	printf("\tlog_level: %d\n", log_level);
+	printf("\tlog_delta: %.1f\n", log_delta);
+	printf("\tlog_heartbeat: %d\n", log_heartbeat);
+	printf("\tlog_flush: %d\n", log_flush);
+	printf("\tlog_syslog: %d\n", log_syslog);
+
+	printf("\tcpufreq_cap: %d\n", cpufreq_cap);
+	if(cpufreq_cap)
+	{
+		printf("\tcpufreq_step: %d\n", cpufreq_step);
+		printf("\tcpufreq_floor: %d\n", cpufreq_floor);
+		printf("\tcpufreq_hyst: %d\n", cpufreq_hyst);
+	}
+}
+
+//-----------------------------------------------------------------------------
+// only the profiles of another config file, for the shadow controller.
+// The active profiles are left as they are.
+
+int read_cfg_profiles(char *name, struct profile *list)
+{
+	struct profile active[MAX_PROFILES];
+	int active_count = profile_count;
+	int count;
+
+	fp = fopen(name, "r");
+	if(fp == NULL)
+	{
+		return 0;
+	}
+
+	memcpy(active, profiles, sizeof(profiles));
+
+	read_profiles();
+	fclose(fp);
+
+	count = profile_count;
+	memcpy(list, profiles, sizeof(profiles));
+
+	memcpy(profiles, active, sizeof(profiles));
+	profile_count = active_count;
+
+	return count;
 }
 
 //-----------------------------------------------------------------------------
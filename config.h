@@ -17,21 +17,116 @@
 #ifndef CONFIG_H_
 #define CONFIG_H_
 
-extern float temp_avg_floor;
-extern float temp_avg_ceiling;
+#include <limits.h>
 
-extern float temp_TC0P_floor;
-extern float temp_TC0P_ceiling;
+#define PROFILE_NAME_MAXLEN	32
+#define MAX_PROFILES			8
 
-extern float temp_TG0P_floor;
-extern float temp_TG0P_ceiling;
+struct profile
+{
+	char name[PROFILE_NAME_MAXLEN];
+
+	float temp_avg_floor;
+	float temp_avg_ceiling;
+
+	float temp_TC0P_floor;
+	float temp_TC0P_ceiling;
+
+	float temp_TG0P_floor;
+	float temp_TG0P_ceiling;
+
+	float fan_min;
+
+	float avg_slope;		// precalculated rpm per degree above floor
+	float TC0P_slope;
+	float TG0P_slope;
+};
+
+extern struct profile profiles[MAX_PROFILES];
+extern int profile_count;
+
+extern struct profile *profile;			// active profile
+extern struct profile *profile_ac;		// NULL selects default
+extern struct profile *profile_battery;
+extern struct profile *profile_forced;	// manual override, NULL if none
+
+struct profile *find_profile(char *name);
 
-extern float fan_min;
 extern float fan_max;
 
 extern int log_level;
+extern float log_delta;			// degrees a temp must move to be logged
+extern int log_heartbeat;		// seconds, log at least this often
+extern int log_flush;			// seconds, flush log file at least this often
+extern int log_syslog;			// 1 to log temp / fan lines to syslog
+
+extern int fan_tolerance;		// rpm, fan has reached target when within
+extern int fan_fb_cycles;		// cycles off target before acting
+extern int fan_correct;			// 1 to correct for fans undershooting
+extern int fan_correct_max;		// max rpm correction
+extern int fan_stall_rpm;		// below this the fan is stalled
+
+extern int fan_slew_up;			// rpm per second, 0 is unlimited
+extern int fan_slew_down;
+extern float temp_avg_hyst;		// degrees a source must drop before followed
+extern float temp_TC0P_hyst;
+extern float temp_TG0P_hyst;
+
+#define MODE_RAMP		0		// fan_mode values, floor / ceiling ramps
+#define MODE_PID		1		// hold pid_target
+
+extern int fan_mode;
+extern float pid_target;		// degrees
+extern int pid_sources;			// bit (1 << CTL_x) per source held at pid_target
+extern float pid_kp;			// rpm per degree
+extern float pid_ki;			// rpm per degree second
+extern float pid_kd;			// rpm per degree per second
+extern float pid_d_filter;		// seconds, time constant of derivative low pass
+
+extern int fan_optimize;		// 1 to search for the speed using the least power
+extern float fan_power;			// watts per fan at fan_max
+extern int optimize_step;		// rpm per step
+extern int optimize_dwell;		// seconds per step
+extern float optimize_margin;	// degrees below the ceilings the optimizer stops
+
+#define AVG_MEAN		0		// temp_avg_mode values
+#define AVG_TRIMMED		1
+#define AVG_MEDIAN		2
+#define AVG_MAX			3		// hottest sensor of each group
+
+#define MAX_WEIGHTS		16
+#define WEIGHT_LABEL_MAXLEN	24
+
+extern int temp_avg_mode;
+extern int temp_avg_trim;		// percent dropped at each end in AVG_TRIMMED
+extern float temp_outlier;		// degrees from the median of its peers to reject a sensor, 0 is off
+
+float avg_weight(char *label);	// weight of a sensor in temp_avg, default 1
+
+#define BIND_MAXLEN		64
+extern char bind_TC0P[BIND_MAXLEN];	// [chip/]label of sensor driving TC0P
+extern char bind_TG0P[BIND_MAXLEN];
+extern int smc_poll;			// read applesmc sensors every n cycles
+
+extern char metrics_file[PATH_MAX];	// textfile collector file, empty if off
+extern int metrics_interval;	// seconds between metrics writes
+
+extern unsigned long config_reloads;
+
+extern int stats_interval;		// seconds between statistics in the log, 0 is off
+
+extern int temp_alarm;			// 1 to program hwmon limits and wake on their alarms
+extern int temp_crit;			// tempN_crit in degrees, 0 leaves it alone
+
+extern char shadow_cfg[PATH_MAX];	// config evaluated next to the active one, empty if off
+
+extern int cpufreq_cap;			// 1 to throttle cpu when fans are saturated
+extern int cpufreq_step;		// percent of max freq per step
+extern int cpufreq_floor;		// never cap below this percentage
+extern int cpufreq_hyst;		// degrees below ceiling before raising the cap
 
 void read_cfg(char* name);
+int read_cfg_profiles(char *name, struct profile *list);	// returns profile count, 0 on error
 
 #define MAX_EXCLUDE		20
 extern int exclude[MAX_EXCLUDE];	// array of sensors to exclude
@@ -16,6 +16,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -23,13 +24,17 @@
 #include <dirent.h>
 #include <assert.h>
 #include <unistd.h>
+#include <time.h>
+#include <syslog.h>
 #include "config.h"
+#include "control.h"
+#include "hwmon.h"
+#include "probes.h"
+#include "energy.h"
+#include "trace.h"
 
 //------------------------------------------------------------------------------
 
-#define HWMON_DIR		"/sys/class/hwmon"
-#define APPLESMC_ID		"applesmc"
-
 struct
 {
 	char *key;
@@ -56,24 +61,13 @@ sensor_desc[] =
 };
 #define N_DESC			(sizeof(sensor_desc) / sizeof(sensor_desc[0]))
 
-#define SENSKEY_MAXLEN	16
-
-struct sensor
-{
-	int id;
-	int excluded;
-	char name[SENSKEY_MAXLEN];
-	char fname[PATH_MAX];
-	float value;
-};
+#define FAN_REWRITE		300		// seconds, fanN_min is rewritten this often even if unchanged
 
 //------------------------------------------------------------------------------
 
 char base_path[PATH_MAX];
-char fan1_min[PATH_MAX];
-char fan2_min[PATH_MAX];
-char fan1_man[PATH_MAX];
-char fan2_man[PATH_MAX];
+
+struct fan fans[MAX_FANS];
 
 int sensor_count = 0;
 int fan_count = 0;
@@ -84,279 +78,947 @@ struct sensor *sensors = NULL;
 struct sensor *sensor_TC0P = NULL;
 struct sensor *sensor_TG0P = NULL;
 
-#define CTL_NONE	0	// sensor control fan flags
-#define CTL_AVG		1
-#define CTL_TC0P	2
-#define CTL_TG0P	3
-
 int fan_ctl = 0;		// which sensor controls fan
 
+float input_avg = 0;			// source temperatures after hysteresis
+float input_TC0P = 0;
+float input_TG0P = 0;
+
+float cycle_time = 0;			// seconds spent in last adjust()
+
+unsigned long sensor_reads = 0;
+unsigned long read_errors = 0;
+unsigned long fan_writes = 0;
+unsigned long fan_writes_elided = 0;
+unsigned long resumes = 0;
+
+static unsigned int poll_cycle = 0;		// read_sensors() cycles, for poll_div
+static int smc_due = 1;					// applesmc read this cycle, fans are read with it
+static double feedback_hold = 0;		// no fan feedback until then, see control_resume()
+static double last_calc = -1;			// time of last calc_fan(), for slew rates
+
+static int pid_fresh = 1;				// no history, after (re)scan
+static unsigned long pid_reloads = 0;	// config_reloads at last pid_update()
+static int pid_warned = 0;		// no pid_sources sensor found, ramp used
+static float pid_p;						// terms of last output
+static float pid_i;
+static float pid_d;
+static float pid_deriv;					// filtered derivative of the error
+static float pid_last_err;
+
+static double monotonic_time();
+double (*get_time)() = monotonic_time;	// replaced by the simulator
+
+//------------------------------------------------------------------------------
+
+// returns -1 if the chip path is too long for the fan attributes
+
+static int fan_paths()
+{
+	strcpy(base_path, chip_applesmc->path);
+
+	// create paths to fans
+
+	int i;
+	for(i = 0; i < MAX_FANS; ++i)
+	{
+		fans[i].id = i + 1;
+		if(snprintf(fans[i].min_path, sizeof(fans[i].min_path), "%s/fan%d_min", base_path, fans[i].id) >= sizeof(fans[i].min_path) ||
+		   snprintf(fans[i].man_path, sizeof(fans[i].man_path), "%s/fan%d_manual", base_path, fans[i].id) >= sizeof(fans[i].man_path) ||
+		   snprintf(fans[i].input_path, sizeof(fans[i].input_path), "%s/fan%d_input", base_path, fans[i].id) >= sizeof(fans[i].input_path))
+		{
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
 //------------------------------------------------------------------------------
 
 void find_applesmc()
 {
-	DIR *fd_dir;
-	int ret;
+	// find all chips we can read, the fans are always on applesmc
 
-	base_path[0] = 0;
+	find_chips();
 
-	// find and verify applesmc path in /sys/devices
+	if(chip_applesmc == NULL)
+	{
+		printf("Error: Can't find a applesmc device\n");
+		exit(-1);
+	}
 
-	fd_dir = opendir(HWMON_DIR);
+	if(fan_paths() != 0)
+	{
+		printf("Error: applesmc path too long: %s\n", chip_applesmc->path);
+		exit(-1);
+	}
+}
+
+//------------------------------------------------------------------------------
+
+static double monotonic_time()
+{
+	struct timespec ts;
 
-	if(fd_dir != NULL)
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//------------------------------------------------------------------------------
+// sensors feeding neither temp_avg nor a source are only read when they are
+// logged or traced
+
+int sensor_polled(struct sensor *s)
+{
+	if(s->excluded)
 	{
-		struct dirent *dir_entry;
+		return 0;
+	}
+
+	return (s->in_avg && s->weight > 0) || s == sensor_TC0P || s == sensor_TG0P ||
+		   log_level > 1 || trace_capturing();
+}
 
-		while((dir_entry = readdir(fd_dir)) != NULL && base_path[0] == 0)
+//------------------------------------------------------------------------------
+
+void read_sensors()
+{
+	unsigned long reads = sensor_reads;
+	unsigned long errors = read_errors;
+	int i;
+
+	PROBE(read_sensors_start);
+
+	smc_due = chip_applesmc == NULL || poll_cycle % chip_applesmc->poll_div == 0;
+
+	for(i = 0; i < sensor_count; ++i)
+	{
+		// slow chips (applesmc) may be polled less often than every cycle
+
+		if(sensor_polled(&sensors[i]) && poll_cycle % sensors[i].chip->poll_div == 0)
 		{
-			if(dir_entry->d_name[0] != '.')
+			// read temp value
+
+			int val = 0;
+			int ok = read_attr(sensors[i].fname, &val) == 0;
+			if(ok)
+			{
+				sensors[i].value = (float)val / 1000.0;
+			}
+			else
 			{
-				char name_path[PATH_MAX];
-				int fd_name;
+				++read_errors;
+			}
+			++sensor_reads;
+
+			PROBE5(sensor_read, sensors[i].chip->name, sensors[i].name, sensors[i].id, val, ok);
+		}
+	}
 
-				sprintf(name_path, "%s/%s/device/name", HWMON_DIR, dir_entry->d_name);
+	++poll_cycle;
 
-				fd_name = open(name_path, O_RDONLY);
+	PROBE2(read_sensors_end, sensor_reads - reads, read_errors - errors);
 
-				if(fd_name > -1)
-				{
-					char name[sizeof(APPLESMC_ID)];
-
-					ret = read(fd_name, name, sizeof(APPLESMC_ID) - 1);
-
-					close(fd_name);
-
-					if(ret == sizeof(APPLESMC_ID) - 1)
-					{
-						if(strncmp(name, APPLESMC_ID, sizeof(APPLESMC_ID) - 1) == 0)
-						{
-							char *dev_path;
-							char *last_slash = strrchr(name_path, '/');
-
-							if(last_slash != NULL)
-							{
-								*last_slash = 0;
-
-								dev_path = realpath(name_path, NULL);
-
-								if(dev_path != NULL)
-								{
-									strncpy(base_path, dev_path, sizeof(base_path) - 1);
-									base_path[sizeof(base_path) - 1] = 0;
-									free(dev_path);
-								}
-							}
-						}
-					}
-				}
+	calc_avg();
+}
+
+//------------------------------------------------------------------------------
+
+// peers are sensors of the same chip and kind, i.e. the TC* cpu sensors of
+// applesmc, a gpu running hotter than the cpu is no outlier
+
+static int is_peer(struct sensor *a, struct sensor *b)
+{
+	return a->chip == b->chip && strncmp(a->name, b->name, 2) == 0;
+}
+
+//------------------------------------------------------------------------------
+// flag sensors too far from the median of their peers, i.e. a stuck sensor
+// reading 127C, and drop them from the sorted list. Sensors with less than
+// two peers are never rejected, there is nothing to compare them with.
+
+static int reject_outliers(struct sensor **list, int n)
+{
+	float peers[MAX_SENSOR_ID];
+	int i;
+	int j;
+	int kept = 0;
+
+	if(temp_outlier <= 0 || n < 3)
+	{
+		return n;
+	}
+
+	for(i = 0; i < n; ++i)
+	{
+		int m = 0;
+
+		for(j = 0; j < n; ++j)
+		{
+			if(is_peer(list[i], list[j]))
+			{
+				peers[m++] = list[j]->value;	// in order, list is sorted
+			}
+		}
+
+		float median = m % 2 ? peers[m / 2] : (peers[m / 2 - 1] + peers[m / 2]) / 2;
+		float dev = list[i]->value - median;
+		int rejected = m >= 3 && (dev > temp_outlier || dev < -temp_outlier);
+
+		if(rejected != list[i]->rejected)
+		{
+			printf("Sensor %s %s, %.1fC, median of peers %.1fC\n", list[i]->name,
+				   rejected ? "rejected" : "accepted again", list[i]->value, median);
+			fflush(stdout);
+			list[i]->rejected = rejected;
+		}
+
+		if(! rejected)
+		{
+			list[kept++] = list[i];
+		}
+	}
+
+	return kept;
+}
+
+//------------------------------------------------------------------------------
+
+static float weighted_mean(struct sensor **list, int n)
+{
+	float sum = 0;
+	float weights = 0;
+	int i;
+
+	for(i = 0; i < n; ++i)
+	{
+		sum += list[i]->value * list[i]->weight;
+		weights += list[i]->weight;
+	}
+
+	return sum / weights;
+}
+
+//------------------------------------------------------------------------------
+
+static float weighted_median(struct sensor **list, int n)
+{
+	float weights = 0;
+	float acc = 0;
+	int i;
+
+	for(i = 0; i < n; ++i)
+	{
+		weights += list[i]->weight;
+	}
+
+	for(i = 0; i < n - 1; ++i)
+	{
+		acc += list[i]->weight;
+		if(acc >= weights / 2)
+		{
+			break;
+		}
+	}
+
+	return list[i]->value;
+}
+
+//------------------------------------------------------------------------------
+// groups are the first two letters of the SMC key, TC is CPU, TG is GPU etc.
+// The list is sorted, so the first one of a group seen from the top is hottest
+
+static float max_of_groups(struct sensor **list, int n)
+{
+	struct sensor *hottest[MAX_SENSOR_ID];
+	int groups = 0;
+	int i;
+	int j;
+
+	for(i = n - 1; i >= 0; --i)
+	{
+		for(j = 0; j < groups && strncmp(hottest[j]->name, list[i]->name, 2) != 0; ++j)
+			;
+
+		if(j == groups)
+		{
+			hottest[groups++] = list[i];
+		}
+	}
+
+	return weighted_mean(hottest, groups);
+}
+
+//------------------------------------------------------------------------------
+
+void calc_avg()
+{
+	struct sensor *list[MAX_SENSOR_ID];
+	int n = 0;
+	int i;
+	int j;
+
+	// sorted by value, insertion sort, there are only a handful
+
+	for(i = 0; i < sensor_count && n < MAX_SENSOR_ID; ++i)
+	{
+		struct sensor *s = &sensors[i];
+
+		if(! s->excluded && s->in_avg && s->weight > 0)
+		{
+			for(j = n; j > 0 && list[j - 1]->value > s->value; --j)
+			{
+				list[j] = list[j - 1];
 			}
+			list[j] = s;
+			++n;
 		}
-		closedir(fd_dir);
 	}
 
-	// create paths to fan and sensor
+	n = reject_outliers(list, n);
+
+	if(n == 0)
+	{
+		return;		// nothing to average, keep the last value
+	}
+
+	switch(temp_avg_mode)
+	{
+	case AVG_TRIMMED:
+		i = n * temp_avg_trim / 100;
+		temp_avg = weighted_mean(list + i, n - 2 * i);
+		break;
+	case AVG_MEDIAN:
+		temp_avg = weighted_median(list, n);
+		break;
+	case AVG_MAX:
+		temp_avg = max_of_groups(list, n);
+		break;
+	default:
+		temp_avg = weighted_mean(list, n);
+		break;
+	}
+}
+
+//------------------------------------------------------------------------------
+// fan speed the profile p asks for at the current temperatures, no I/O
+
+int calc_speed(struct profile *p, int *ctl)
+{
+	int speed = p->fan_min;
+
+	*ctl = CTL_NONE;
+
+	// calc fan speed on average
+
+	float fan_avg_speed = (input_avg - p->temp_avg_floor) * p->avg_slope;
+	if(fan_avg_speed > speed)
+	{
+		speed = fan_avg_speed;
+		*ctl = CTL_AVG;
+	}
+
+	// calc fan speed for TC0P
+
+	if(sensor_TC0P != NULL)
+	{
+		float fan_TC0P_speed = (input_TC0P - p->temp_TC0P_floor) * p->TC0P_slope;
+		if(fan_TC0P_speed > speed)
+		{
+			speed = fan_TC0P_speed;
+			*ctl = CTL_TC0P;
+		}
+	}
+
+	// calc fan speed for TG0P
+
+	if(sensor_TG0P != NULL)
+	{
+		float fan_TG0P_speed = (input_TG0P - p->temp_TG0P_floor) * p->TG0P_slope;
+		if(fan_TG0P_speed > speed)
+		{
+			speed = fan_TG0P_speed;
+			*ctl = CTL_TG0P;
+		}
+	}
+
+	// finally clamp
+
+	return min(fan_max, speed);
+}
+
+//------------------------------------------------------------------------------
+// rising temperatures are followed at once, falling ones only when they have
+// dropped more than band, a sensor wobbling on a floor doesn't toggle the fan
+
+static float hysteresis(float input, float temp, float band)
+{
+	if(temp > input || temp < input - band)
+	{
+		return temp;
+	}
+
+	return input;
+}
+
+//------------------------------------------------------------------------------
+// error of the pid_sources source furthest above pid_target
+
+static float pid_error(int *ctl)
+{
+	float err = -1000;
+	float temp[CTL_TG0P + 1];
+	int i;
+
+	temp[CTL_AVG] = temp_avg;
+	temp[CTL_TC0P] = sensor_TC0P != NULL ? sensor_TC0P->value : -1000;
+	temp[CTL_TG0P] = sensor_TG0P != NULL ? sensor_TG0P->value : -1000;
+
+	*ctl = CTL_NONE;
+
+	for(i = CTL_AVG; i <= CTL_TG0P; ++i)
+	{
+		if((pid_sources & (1 << i)) && temp[i] - pid_target > err)
+		{
+			err = temp[i] - pid_target;
+			*ctl = i;
+		}
+	}
+
+	return *ctl == CTL_NONE ? 0 : err;
+}
+
+//------------------------------------------------------------------------------
+// PID output, unclamped. The derivative is taken on the error through a
+// first order low pass. The integral is corrected by pid_track().
+
+static float pid_update(float dt, int *ctl)
+{
+	float err = pid_error(ctl);
+
+	if(pid_fresh)
+	{
+		pid_deriv = 0;
+	}
+	else if(dt > 0)
+	{
+		float raw = (err - pid_last_err) / dt;
+		pid_deriv += dt / (pid_d_filter + dt) * (raw - pid_deriv);
+	}
+
+	pid_last_err = err;
+	pid_p = pid_kp * err;
+	pid_d = pid_kd * pid_deriv;
+
+	// bumpless start and config reload, new gains continue from the current speed
+
+	if(pid_fresh || pid_reloads != config_reloads)
+	{
+		pid_i = fan_speed - pid_p - pid_d;
+		pid_reloads = config_reloads;
+	}
+	else
+	{
+		pid_i += pid_ki * err * dt;
+	}
+
+	pid_fresh = 0;
+
+	return pid_p + pid_i + pid_d;
+}
+
+//------------------------------------------------------------------------------
+// anti windup by back calculation: when the speed set differs from the PID
+// output (clamped, slew limited or ramp mode), the integral is moved so the
+// output matches. Switching to PID mode is then bumpless as well.
+
+static void pid_track(float output, int speed)
+{
+	float diff = speed - output;
+
+	if(fan_mode != MODE_PID || diff > 1 || diff < -1)
+	{
+		pid_i += diff;
+	}
+}
+
+//------------------------------------------------------------------------------
+
+void calc_fan()
+{
+	double now = get_time();
+	float dt = last_calc >= 0 ? now - last_calc : 0;
+	int speed;
+	int pid_ctl;
+
+	input_avg = hysteresis(input_avg, temp_avg, temp_avg_hyst);
+
+	if(sensor_TC0P != NULL)
+	{
+		input_TC0P = hysteresis(input_TC0P, sensor_TC0P->value, temp_TC0P_hyst);
+	}
+
+	if(sensor_TG0P != NULL)
+	{
+		input_TG0P = hysteresis(input_TG0P, sensor_TG0P->value, temp_TG0P_hyst);
+	}
+
+	// the PID runs in both modes, tracking the ramp when not in use
+
+	float output = pid_update(dt, &pid_ctl);
+
+	// without any of its sources the PID would hold the fans where they are,
+	// fall back to the ramp until one shows up
+
+	if(fan_mode == MODE_PID && pid_ctl == CTL_NONE && ! pid_warned)
+	{
+		printf("Warning: No pid_sources sensor found, using the ramp\n");
+		fflush(stdout);
+	}
+
+	pid_warned = fan_mode == MODE_PID && pid_ctl == CTL_NONE;
+
+	if(fan_mode == MODE_PID && pid_ctl != CTL_NONE)
+	{
+		speed = max(profile->fan_min, min(fan_max, output));
+		fan_ctl = pid_ctl;
+	}
+	else
+	{
+		speed = calc_speed(profile, &fan_ctl);
+	}
+
+	speed = optimize_speed(speed);
+
+	int unlimited = speed;
+
+	// limit rate of change, fast up to protect the hardware, slow down
+
+	if(dt > 0)
+	{
+		if(fan_slew_up > 0)
+		{
+			speed = min(speed, fan_speed + (int)(fan_slew_up * dt));
+		}
+
+		if(fan_slew_down > 0)
+		{
+			speed = max(speed, fan_speed - (int)(fan_slew_down * dt));
+		}
+	}
+
+	pid_track(output, speed);
+
+	last_calc = now;
+	fan_speed = speed;
+
+	PROBE3(calc_fan, fan_ctl, fan_speed, unlimited);
+}
+
+//------------------------------------------------------------------------------
+
+static void fan_alarm(struct fan *fan, int alarm)
+{
+	char *what = alarm == FAN_STALLED ? "STALLED" : "DEGRADED";
+
+	if(alarm != FAN_OK)
+	{
+		printf("ALARM: Fan %d %s, %d rpm requested, %d rpm measured! Raising other fans to max.\n",
+			   fan->id, what, fan->target + fan->correction, fan->actual);
+		syslog(LOG_CRIT, "fan %d %s, %d rpm requested, %d rpm measured",
+			   fan->id, what, fan->target + fan->correction, fan->actual);
+	}
+	else
+	{
+		printf("Fan %d recovered, %d rpm measured.\n", fan->id, fan->actual);
+		syslog(LOG_WARNING, "fan %d recovered, %d rpm measured", fan->id, fan->actual);
+	}
+
+	fan->alarm = alarm;
+	fflush(stdout);
+}
+
+//------------------------------------------------------------------------------
+// read back fanN_input to see what the last set_fan() achieved, on the
+// cycles applesmc is read, smc_poll applies to the fans too
+
+void read_fans()
+{
+	int i;
+	double now = get_time();
+
+	if(! smc_due)
+	{
+		return;
+	}
+
+	for(i = 0; i < fan_count; ++i)
+	{
+		struct fan *fan = &fans[i];
+		int rpm;
+
+		if(read_attr(fan->input_path, &rpm) != 0)
+		{
+			++read_errors;
+			continue;
+		}
+
+		fan->actual = rpm;
+
+		if(now < feedback_hold)
+		{
+			continue;		// spinning up after resume, short cycles would raise false alarms
+		}
+
+		int requested = fan->target + fan->correction;
+
+		// rise time, from target change until within tolerance
+
+		if(fan->settling && abs(fan->actual - requested) <= fan_tolerance)
+		{
+			fan->settling = 0;
+			fan->rise_time = now - fan->step_time;
+
+			if(log_level > 0)
+			{
+				printf("Fan %d reached %d rpm in %.1fs\n", fan->id, fan->actual, fan->rise_time);
+			}
+		}
+
+		// stall detection, the SMC never stops a healthy fan
+
+		if(fan->actual < fan_stall_rpm)
+		{
+			++fan->stall_cycles;
+		}
+		else
+		{
+			fan->stall_cycles = 0;
+		}
+
+		// closed loop correction when fan consistently undershoots
+
+		if(fan->target > 0 && fan->actual < requested - fan_tolerance)
+		{
+			++fan->under_cycles;
+
+			if(fan->under_cycles >= fan_fb_cycles)
+			{
+				fan->written = -1;		// the SMC or another tool may have reset fanN_min
+			}
+
+			if(fan->under_cycles >= fan_fb_cycles && fan_correct && fan->stall_cycles == 0)
+			{
+				int step = (requested - fan->actual) / 2;
+				fan->correction = min(fan_correct_max, fan->correction + step);
+				fan->correction = min((int)fan_max - fan->target, fan->correction);
+				fan->correction = max(0, fan->correction);
+			}
+		}
+		else
+		{
+			fan->under_cycles = 0;
+
+			if(fan->correction > 0 && fan->actual > requested + fan_tolerance)
+			{
+				int step = (fan->actual - requested) / 2;
+				fan->correction = max(0, fan->correction - step);
+			}
+		}
+
+		// raise or clear alarms
+
+		int alarm = FAN_OK;
+
+		if(fan->stall_cycles >= fan_fb_cycles)
+		{
+			alarm = FAN_STALLED;
+		}
+		else if(fan->under_cycles >= 2 * fan_fb_cycles)
+		{
+			alarm = FAN_DEGRADED;	// correction didn't help, still too slow
+		}
+
+		if(alarm != fan->alarm)
+		{
+			fan_alarm(fan, alarm);
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+
+void set_fan()
+{
+	int i;
+	int alarm = 0;
+	double now = get_time();
+
+	for(i = 0; i < fan_count; ++i)
+	{
+		alarm |= fans[i].alarm != FAN_OK;
+	}
+
+	for(i = 0; i < fan_count; ++i)
+	{
+		struct fan *fan = &fans[i];
+
+		// a failing fan is left alone, the others compensate at max
+
+		int target = alarm && fan->alarm == FAN_OK ? (int)fan_max : fan_speed;
+
+		if(abs(target - fan->target) > fan_tolerance)
+		{
+			fan->step_time = now;
+			fan->settling = 1;
+			fan->under_cycles = 0;
+		}
+
+		fan->target = target;
+
+		// update fan, set fan manual to zero
+		// skip the SMC write if the fan already has this value, but
+		// rewrite it now and then in case it was reset behind our back
+
+		int speed = min((int)fan_max, fan->target + fan->correction);
+
+		if(speed == fan->written && now - fan->write_time < FAN_REWRITE)
+		{
+			++fan_writes_elided;
+			continue;
+		}
+
+		int ok = write_attr(fan->min_path, speed) == 0 && write_attr(fan->man_path, 0) == 0;
+
+		fan->written = ok ? speed : -1;
+		fan->write_time = now;
+		++fan_writes;
+
+		PROBE3(fan_write, fan->id, speed, ok);
+	}
+}
+
+//------------------------------------------------------------------------------
+
+void adjust()
+{
+	double start = get_time();
+
+	read_sensors();
+	read_fans();
+	calc_fan();
+	set_fan();
+
+	cycle_time = get_time() - start;
+}
+
+//------------------------------------------------------------------------------
+// after suspend the SMC may have reset fanN_min and every value read is stale:
+// read all chips next cycle and rewrite the fans, whatever was written before
+
+void control_resume(float hold)
+{
+	int i;
 
-	if(base_path[0] == 0)
+	poll_cycle = 0;
+	feedback_hold = get_time() + hold;
+
+	for(i = 0; i < fan_count; ++i)
 	{
-		printf("Error: Can't find a applesmc device\n");
-		exit(-1);
+		fans[i].written = -1;
+		fans[i].under_cycles = 0;
+		fans[i].stall_cycles = 0;
+		fans[i].settling = 0;
 	}
 
-	sprintf(fan1_min, "%s/fan1_min", base_path);
-	sprintf(fan2_min, "%s/fan2_min", base_path);
-	sprintf(fan1_man, "%s/fan1_manual", base_path);
-	sprintf(fan2_man, "%s/fan2_manual", base_path);
-
-	printf("Found applesmc at %s\n", base_path);
+	++resumes;
 }
 
 //------------------------------------------------------------------------------
 
-void read_sensors()
+static void read_label(struct sensor *sensor)
 {
-	int i;
-	for(i = 0; i < sensor_count; ++i)
-	{
-		if(! sensors[i].excluded)
-		{
-			// read temp value
+	char fname[PATH_MAX + 16];
 
-			int fd = open(sensors[i].fname, O_RDONLY);
-			if(fd < 0)
-			{
-				printf("Error: Can't open %s\n", sensors[i].fname);
-				fflush(stdout);
-			}
-			else
-			{
-				char val_buf[16];
-				int n = read(fd, val_buf, sizeof(val_buf));
-				if(n < 1)
-				{
-					printf("Error: Can't read  %s\n", sensors[i].fname);
-				}
-				else
-				{
-					sensors[i].value = (float)atoi(val_buf) / 1000.0;
-				}
-				close(fd);
-			}
-		}
-	}
+	snprintf(fname, sizeof(fname), "%s/temp%d_label", sensor->chip->path, sensor->id);
 
-	// calc average
+	// chips without labels (acpitz, drivetemp) get named after the attribute
 
-	temp_avg = 0.0;
-	int active_sensors = 0;
+	snprintf(sensor->name, SENSKEY_MAXLEN, "temp%d", sensor->id);
 
-	for(i = 0; i < sensor_count; ++i)
+	FILE *fp = fopen(fname, "r");
+	if(fp == NULL)
 	{
-		if(! sensors[i].excluded)
+		if(sensor->chip == chip_applesmc)
 		{
-			temp_avg += sensors[i].value;
-			++active_sensors;
+			printf("Error: Can't open %s\n", fname);
 		}
 	}
+	else
+	{
+		char key_buf[SENSKEY_MAXLEN];
+		memset(key_buf, 0, SENSKEY_MAXLEN);
 
-	temp_avg = temp_avg / active_sensors;
+		int n = fread(key_buf, 1, SENSKEY_MAXLEN - 1, fp);
+		if(n < 1)
+		{
+			printf("Error: Can't read  %s\n", fname);
+		}
+		else
+		{
+			char *p_endl = strrchr(key_buf, '\n');
+			if(p_endl)
+			{
+				*p_endl = 0; 	// remove '\n'
+			}
+			strncpy(sensor->name, key_buf, SENSKEY_MAXLEN);
+		}
+		fclose(fp);
+	}
 }
 
 //------------------------------------------------------------------------------
+// binding format is: [chip/]label, without chip applesmc is preferred
 
-void calc_fan()
+static struct sensor *bind_sensor(char *binding)
 {
-	fan_speed = fan_min;
-	fan_ctl = CTL_NONE;
+	char chip_name[CHIPNAME_MAXLEN];
+	char *label = binding;
+	int i;
 
-	// calc fan speed on average
+	chip_name[0] = 0;
 
-	float fan_window = fan_max - fan_min;
-	float temp_avg_window = temp_avg_ceiling - temp_avg_floor;
-	float normalized_temp =(temp_avg - temp_avg_floor) / temp_avg_window;
-	float fan_avg_speed =(normalized_temp * fan_window);
-	if(fan_avg_speed > fan_speed)
+	char *slash = strchr(binding, '/');
+	if(slash != NULL)
 	{
-		fan_speed = fan_avg_speed;
-		fan_ctl = CTL_AVG;
+		int len = min(slash - binding, CHIPNAME_MAXLEN - 1);
+		strncpy(chip_name, binding, len);
+		chip_name[len] = 0;
+		label = slash + 1;
 	}
 
-	// calc fan speed for TC0P
+	struct sensor *found = NULL;
 
-	if(sensor_TC0P != NULL)
+	for(i = 0; i < sensor_count; ++i)
 	{
-		float temp_window = temp_TC0P_ceiling - temp_TC0P_floor;
-		float normalized_temp =(sensor_TC0P->value - temp_TC0P_floor) / temp_window;
-		float fan_TC0P_speed =(normalized_temp * fan_window);
-		if(fan_TC0P_speed > fan_speed)
+		if(! sensors[i].excluded && strcmp(sensors[i].name, label) == 0)
 		{
-			fan_speed = fan_TC0P_speed;
-			fan_ctl = CTL_TC0P;
+			if(chip_name[0] != 0)
+			{
+				if(strcmp(sensors[i].chip->name, chip_name) == 0)
+				{
+					return &sensors[i];
+				}
+			}
+			else if(sensors[i].chip == chip_applesmc)
+			{
+				return &sensors[i];
+			}
+			else if(found == NULL)
+			{
+				found = &sensors[i];
+			}
 		}
 	}
 
-	// calc fan speed for TG0P
+	return found;
+}
 
-	if(sensor_TG0P != NULL)
+//------------------------------------------------------------------------------
+// exclude list only applies to applesmc
+
+static int is_excluded(struct sensor *sensor)
+{
+	int j;
+
+	if(sensor->chip == chip_applesmc)
 	{
-		float temp_window = temp_TG0P_ceiling - temp_TG0P_floor;
-		float normalized_temp =(sensor_TG0P->value - temp_TG0P_floor) / temp_window;
-		float fan_TG0P_speed =(normalized_temp * fan_window);
-		if(fan_TG0P_speed > fan_speed)
+		for(j = 0; j < MAX_EXCLUDE && exclude[j] != 0; ++j)
 		{
-			fan_speed = fan_TG0P_speed;
-			fan_ctl = CTL_TG0P;
+			if(exclude[j] == sensor->id)
+			{
+				return 1;
+			}
 		}
 	}
 
-	// finally clamp
-
-	fan_speed = min(fan_max, fan_speed);
+	return 0;
 }
 
 //------------------------------------------------------------------------------
+// install a sensor list not read from sysfs, used by trace replay
 
-void set_fan()
+void load_sensors(struct sensor *list, int count)
 {
-	char buf[16];
-
-	// update fan 1
+	int i;
 
-	int fd = open(fan1_min, O_WRONLY);
-	if(fd < 0)
-	{
-		printf("Error: Can't open %s\n", fan1_min);
-	}
-	else
+	if(sensors != NULL)
 	{
-		sprintf(buf, "%d", fan_speed);
-		write(fd, buf, strlen(buf));
-		close(fd);
+		free(sensors);
 	}
 
-	// set fan 1 manual to zero
+	sensors = list;
+	sensor_count = count;
 
-	fd = open(fan1_man, O_WRONLY);
-	if(fd < 0)
-	{
-		printf("Error: Can't open %s\n", fan1_man);
-	}
-	else
+	for(i = 0; i < sensor_count; ++i)
 	{
-		strcpy(buf, "0");
-		write(fd, buf, strlen(buf));
-		close(fd);
+		sensors[i].excluded |= is_excluded(&sensors[i]);
+		sensors[i].in_avg = sensors[i].chip == chip_applesmc;
+		sensors[i].weight = avg_weight(sensors[i].name);
+		sensors[i].rejected = 0;
 	}
 
-	// update fan 2
+	sensor_TC0P = bind_sensor(bind_TC0P);
+	sensor_TG0P = bind_sensor(bind_TG0P);
+}
 
-	if(fan_count > 1)
-	{
-		fd = open(fan2_min, O_WRONLY);
-		if(fd < 0)
-		{
-			printf("Error: Can't open %s\n", fan2_min);
-		}
-		else
-		{
-			sprintf(buf, "%d", fan_speed);
-			write(fd, buf, strlen(buf));
-			close(fd);
-		}
+//------------------------------------------------------------------------------
+// forget what is known about the fans and the control history, for a new
+// applesmc. Alarms still raised are logged, they are found again if the
+// fan is still failing.
 
-		// set fan 2 manual to zero
+static void reset_control()
+{
+	int i;
 
-		fd = open(fan2_man, O_WRONLY);
-		if(fd < 0)
-		{
-			printf("Error: Can't open %s\n", fan2_man);
-		}
-		else
+	for(i = 0; i < MAX_FANS; ++i)
+	{
+		if(fans[i].alarm != FAN_OK)
 		{
-			strcpy(buf, "0");
-			write(fd, buf, strlen(buf));
-			close(fd);
+			printf("Fan %d alarm dropped, applesmc changed.\n", fans[i].id);
+			syslog(LOG_WARNING, "fan %d alarm dropped, applesmc changed", fans[i].id);
 		}
-	}
 
-	fflush(stdout);
-}
-
-//------------------------------------------------------------------------------
+		fans[i].target = 0;
+		fans[i].actual = 0;
+		fans[i].correction = 0;
+		fans[i].under_cycles = 0;
+		fans[i].stall_cycles = 0;
+		fans[i].alarm = FAN_OK;
+		fans[i].settling = 0;
+		fans[i].rise_time = 0;
+		fans[i].written = -1;
+	}
 
-void adjust()
-{
-	read_sensors();
-	calc_fan();
-	set_fan();
+	last_calc = -1;
+	pid_fresh = 1;
+	optimize_restart();
+	input_avg = 0;
+	input_TC0P = 0;
+	input_TG0P = 0;
 }
 
 //------------------------------------------------------------------------------
+// sensor list and fan count only, fatal: exit without fans or sensors, else
+// return -1
 
-void scan_sensors()
+static int rescan(int fatal)
 {
 	int i;
 	int j;
+	int c;
 	struct stat buf;
 	int result;
 
@@ -365,18 +1027,23 @@ void scan_sensors()
 
 	// get number of fans
 
-	result = stat(fan1_min, &buf);
+	result = stat(fans[0].min_path, &buf);
 	if(result != 0)
 	{
-		printf("No fans detected, terminating!\n");
-		exit(-1);
+		if(fatal)
+		{
+			printf("No fans detected, terminating!\n");
+			exit(-1);
+		}
+		printf("Error: No fans detected\n");
+		return -1;
 	}
 	else
 	{
 		fan_count = 1;
 	}
 
-	result = stat(fan2_min, &buf);
+	result = stat(fans[1].min_path, &buf);
 	if(result != 0)
 	{
 		printf("Found 1 fan.\n");
@@ -387,24 +1054,25 @@ void scan_sensors()
 		printf("Found 2 fans.\n");
 	}
 
-	// count number of sensors
+	// count number of sensors on all chips
+	// coretemp numbering may have gaps, so probe all ids
 
 	int count = 0;
-	while(count < 100)	// more than 100 sensors is an error!
+	for(c = 0; c < chip_count; ++c)
 	{
-		char fname[512];
+		chips[c].poll_div = &chips[c] == chip_applesmc ? smc_poll : 1;
 
-		// sensor numbering start at 1
-		sprintf(fname, "%s/temp%d_input", base_path, count + 1);
-		result = stat(fname, &buf);
-
-		if(result == 0)
-		{
-			++count;
-		}
-		else
+		for(i = 1; i <= MAX_SENSOR_ID; ++i)	// sensor numbering start at 1
 		{
-			break;		// done
+			char fname[PATH_MAX + 16];
+
+			// paths not fitting sensor->fname are skipped in both passes
+
+			int len = snprintf(fname, sizeof(fname), "%s/temp%d_input", chips[c].path, i);
+			if(len < PATH_MAX && stat(fname, &buf) == 0)
+			{
+				++count;
+			}
 		}
 	}
 
@@ -424,77 +1092,57 @@ void scan_sensors()
 
 		printf("Found %d sensors:\n", sensor_count);
 
-		for(i = 0; i < sensor_count; ++i)
+		count = 0;
+		for(c = 0; c < chip_count; ++c)
 		{
-			char fname[512];
-
-			// set id, check exclude list and save file name
-			sensors[i].id = i + 1;
-			sensors[i].excluded = 0;
-			sprintf(sensors[i].fname, "%s/temp%d_input", base_path, sensors[i].id);
-
-			for(j = 0; j < MAX_EXCLUDE && exclude[j] != 0; ++j)
+			for(i = 1; i <= MAX_SENSOR_ID && count < sensor_count; ++i)
 			{
-				if(exclude[j] == sensors[i].id)
+				struct sensor *sensor = &sensors[count];
+
+				int len = snprintf(sensor->fname, sizeof(sensor->fname), "%s/temp%d_input", chips[c].path, i);
+				if(len >= sizeof(sensor->fname) || stat(sensor->fname, &buf) != 0)
 				{
-					sensors[i].excluded = 1;
-					break;
+					continue;
 				}
-			}
 
-			// read label
-			sprintf(fname, "%s/temp%d_label", base_path, sensors[i].id);
+				// set id and chip, check exclude list (applesmc only)
 
-			sensors[i].name[0] = 0; // set zero length
+				sensor->id = i;
+				sensor->chip = &chips[c];
+				sensor->excluded = 0;
+				sensor->in_avg = sensor->chip == chip_applesmc;
+				sensor->rejected = 0;
+				sensor->value = 0;
+				sensor->logged = -1000;		// log on first cycle
 
-			FILE *fp = fopen(fname, "r");
-			if(fp == NULL)
-			{
-				printf("Error: Can't open %s\n", fname);
-			}
-			else
-			{
-				char key_buf[SENSKEY_MAXLEN];
-				memset(key_buf, 0, SENSKEY_MAXLEN);
+				sensor->excluded = is_excluded(sensor);
 
-				int n = fread(key_buf, 1, SENSKEY_MAXLEN - 1, fp);
-				if(n < 1)
-				{
-					printf("Error: Can't read  %s\n", fname);
-				}
-				else
-				{
-					char *p_endl = strrchr(key_buf, '\n');
-					if(p_endl)
-					{
-						*p_endl = 0; 	// remove '\n'
-					}
-					strncpy(sensors[i].name, key_buf, SENSKEY_MAXLEN);
-				}
-				fclose(fp);
+				read_label(sensor);
+				sensor->weight = avg_weight(sensor->name);
+
+				++count;
 			}
 		}
 
-		for(i = 0; i < sensor_count; ++i)		// for each label found
-		{
-			if(! sensors[i].excluded)
-			{
-				// try to find TC0P and TG0P
-				// if found, assign sensor_TC0P and sensor_TG0P for later use
+		sensor_count = count;
 
-				if(strcmp(sensors[i].name, "TC0P") == 0)
-				{
-					sensor_TC0P = &sensors[i];
-				}
-				else if(strcmp(sensors[i].name, "TG0P") == 0)
-				{
-					sensor_TG0P = &sensors[i];
-				}
-			}
+		// find the sensors bound to TC0P and TG0P for later use
+
+		sensor_TC0P = bind_sensor(bind_TC0P);
+		sensor_TG0P = bind_sensor(bind_TG0P);
 
+		for(i = 0; i < sensor_count; ++i)		// for each label found
+		{
 			// print out sensor information.
 
-			printf("\t%2d: ", sensors[i].id);
+			if(sensors[i].chip == chip_applesmc)
+			{
+				printf("\t%2d: ", sensors[i].id);
+			}
+			else
+			{
+				printf("\t%s %2d: ", sensors[i].chip->name, sensors[i].id);
+			}
 
 			int found = 0;
 			for(j = 0; j < N_DESC && ! found; ++j)		// find in descriptions table
@@ -510,58 +1158,276 @@ void scan_sensors()
 				printf("%s - ?", sensors[i].name);
 			}
 
-			printf(" %s\n", sensors[i].excluded ? "   ***EXCLUDED***" : "");
+			printf(" %s%s%s\n",
+				   sensors[i].excluded ? "   ***EXCLUDED***" : "",
+				   &sensors[i] == sensor_TC0P ? "   [TC0P]" : "",
+				   &sensors[i] == sensor_TG0P ? "   [TG0P]" : "");
 		}
 	}
 	else
 	{
-		printf("No sensors detected, terminating!\n");
-		exit(-1);
+		if(fatal)
+		{
+			printf("No sensors detected, terminating!\n");
+			exit(-1);
+		}
+		printf("Error: No sensors detected\n");
+		return -1;
 	}
 
 	fflush(stdout);
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+void scan_sensors()
+{
+	rescan(1);
+	reset_control();
+}
+
+//------------------------------------------------------------------------------
+// hwmon devices came or went, i.e. applesmc was reloaded and moved to another
+// hwmonN, or the config was reloaded. Without applesmc there is nothing to
+// control, the SMC is back on automatic and every sensor and fan is dropped
+// until it reappears. While the same applesmc stays, only the sensor list is
+// rebuilt, fan alarms, corrections and the control history are kept.
+
+void rediscover()
+{
+	struct sensor *old = sensors;
+	int old_count = sensor_count;
+	static char old_chip[MAX_CHIPS][PATH_MAX];	// two drives are both drivetemp
+	char old_smc[PATH_MAX] = "";
+	struct stat buf;
+	int i;
+	int j;
+
+	for(i = 0; i < chip_count; ++i)
+	{
+		strcpy(old_chip[i], chips[i].path);
+	}
+
+	int was_online = fan_count > 0;
+	int old_fan_count = fan_count;
+
+	if(chip_applesmc != NULL)
+	{
+		strcpy(old_smc, chip_applesmc->path);
+	}
+
+	sensors = NULL;		// old list is kept for the values until rescanned
+	sensor_count = 0;
+	sensor_TC0P = NULL;
+	sensor_TG0P = NULL;
+	fan_count = 0;
+
+	find_chips();
+
+	// mid hotplug applesmc may be there without its attributes yet
+
+	if(chip_applesmc == NULL || fan_paths() != 0 || stat(fans[0].min_path, &buf) != 0 || rescan(0) != 0)
+	{
+		free(sensors);
+		sensors = NULL;
+		sensor_count = 0;
+		fan_count = 0;
+
+		if(was_online)
+		{
+			printf("Error: applesmc removed, fan control suspended until it returns\n");
+			syslog(LOG_CRIT, "applesmc removed, fan control suspended");
+			fflush(stdout);
+		}
+	}
+	else
+	{
+		if(! was_online)
+		{
+			printf("applesmc found, fan control resumed.\n");
+			syslog(LOG_WARNING, "applesmc found, fan control resumed");
+		}
+
+		if(! was_online || fan_count != old_fan_count || strcmp(old_smc, chip_applesmc->path) != 0)
+		{
+			reset_control();
+			last_calc = get_time();		// the next step is still slew limited
+		}
+
+		for(i = 0; i < fan_count; ++i)
+		{
+			fans[i].written = -1;	// a reloaded driver may have reset them
+		}
+
+		// sensors still present keep their values, no jump in the average
+
+		for(i = 0; i < sensor_count; ++i)
+		{
+			for(j = 0; j < old_count; ++j)
+			{
+				int c = old[j].chip - chips;
+
+				if(old[j].id == sensors[i].id && strcmp(old_chip[c], sensors[i].chip->path) == 0)
+				{
+					sensors[i].value = old[j].value;
+					sensors[i].logged = old[j].logged;
+					break;
+				}
+			}
+		}
+	}
+
+	free(old);
+}
+
+//------------------------------------------------------------------------------
+
+char *ctl_name(int ctl)
+{
+	switch(ctl)
+	{
+	case CTL_AVG:
+		return "AVG";
+	case CTL_TC0P:
+		return "TC0P";
+	case CTL_TG0P:
+		return "TG0P";
+	}
+	return "none";
+}
+
+//------------------------------------------------------------------------------
+
+static char log_line[4096];
+static int log_len;
+
+static void log_out(char *fmt, ...)
+{
+	va_list ap;
+
+	if(log_len < sizeof(log_line))
+	{
+		va_start(ap, fmt);
+		log_len += vsnprintf(log_line + log_len, sizeof(log_line) - log_len, fmt, ap);
+		va_end(ap);
+	}
+}
+
+//------------------------------------------------------------------------------
+
+static int moved(float value, float logged)
+{
+	float diff = value - logged;
+
+	return diff > log_delta || diff < -log_delta;
+}
+
+//------------------------------------------------------------------------------
+// anything worth a log line since the last one?
+
+static int log_changed()
+{
+	static int last_speed = -1;
+	static int last_ctl = -1;
+	static float last_avg = 0;
+	int changed = 0;
+	int i;
+
+	if(fan_speed != last_speed || fan_ctl != last_ctl || moved(temp_avg, last_avg))
+	{
+		changed = 1;
+	}
+
+	for(i = 0; i < sensor_count && ! changed; ++i)
+	{
+		if(! sensors[i].excluded && (log_level > 1 || &sensors[i] == sensor_TC0P || &sensors[i] == sensor_TG0P))
+		{
+			changed = moved(sensors[i].value, sensors[i].logged);
+		}
+	}
+
+	if(changed)
+	{
+		last_speed = fan_speed;
+		last_ctl = fan_ctl;
+		last_avg = temp_avg;
+
+		for(i = 0; i < sensor_count; ++i)
+		{
+			sensors[i].logged = sensors[i].value;
+		}
+	}
+
+	return changed;
 }
 
 //------------------------------------------------------------------------------
 
 void logger()
 {
+	static double last_line = 0;
+	static double last_flush = 0;
 	int i;
+	double now = get_time();
 
-	if(log_level > 0)
+	if(log_level > 0 && (log_changed() || log_delta == 0 || now - last_line >= log_heartbeat))
 	{
-		printf("Speed: %d, %sAVG: %.1fC" ,
+		last_line = now;
+		log_len = 0;
+
+		log_out("Speed: %d, %sAVG: %.1fC" ,
 			   fan_speed,
 			   fan_ctl == CTL_AVG ? "*" : " ",
 			   temp_avg);
 
 		if(sensor_TC0P != NULL)
 		{
-			printf(", %sTC0P: %.1fC" ,
+			log_out(", %sTC0P: %.1fC" ,
 				   fan_ctl == CTL_TC0P ? "*" : " ",
 				   sensor_TC0P->value);
 		}
 
 		if(sensor_TG0P != NULL)
 		{
-			printf(", %sTG0P: %.1fC" ,
+			log_out(", %sTG0P: %.1fC" ,
 				   fan_ctl == CTL_TG0P ? "*" : " ",
 				   sensor_TG0P->value);
 		}
 
 		if(log_level > 1)
 		{
-			printf(", Sensors: ");
+			log_out(", Fans: ");
+			for(i = 0; i < fan_count; ++i)
+			{
+				log_out("%d:%d/%d ", fans[i].id, fans[i].actual, fans[i].target + fans[i].correction);
+			}
+
+			log_out(", Sensors: ");
 			for(i = 0; i < sensor_count; ++i)
 			{
 				if(! sensors[i].excluded)
 				{
-					printf("%s:%.0f ", sensors[i].name, sensors[i].value);
+					log_out("%s:%.0f ", sensors[i].name, sensors[i].value);
 				}
 			}
 		}
 
-		printf("\n");
+		if(log_syslog)
+		{
+			syslog(LOG_INFO, "%s", log_line);
+		}
+		else
+		{
+			printf("%s\n", log_line);
+		}
+	}
+
+	// the log file is fully buffered, flush at least every log_flush seconds
+
+	if(now - last_flush >= log_flush)
+	{
+		last_flush = now;
 		fflush(stdout);
 	}
 }
@@ -17,9 +17,93 @@
 #ifndef CONTROL_H_
 #define CONTROL_H_
 
+#include <limits.h>
+#include "hwmon.h"
+
+#define SENSKEY_MAXLEN	24
+#define MAX_SENSOR_ID	100	// more than 100 sensors per chip is an error!
+
+struct sensor
+{
+	int id;
+	struct chip *chip;
+	int excluded;
+	int in_avg;			// part of temp_avg
+	float weight;		// in temp_avg, 0 leaves it out
+	int rejected;		// too far from the other temp_avg sensors
+	char name[SENSKEY_MAXLEN];
+	char fname[PATH_MAX];
+	float value;
+	float logged;		// value at last log line
+};
+
+#define MAX_FANS	2
+
+#define FAN_OK			0	// fan alarm states
+#define FAN_STALLED		1
+#define FAN_DEGRADED	2
+
+struct fan
+{
+	int id;
+	char min_path[PATH_MAX];
+	char man_path[PATH_MAX];
+	char input_path[PATH_MAX];
+	int target;				// requested speed
+	int actual;				// measured speed, fanN_input
+	int correction;			// closed loop offset added to target
+	int written;			// last value written to fanN_min, -1 if unknown
+	double write_time;		// when it was written
+	int under_cycles;		// consecutive cycles below target
+	int stall_cycles;		// consecutive cycles below fan_stall_rpm
+	int alarm;
+	int settling;			// target changed, not reached yet
+	double step_time;		// when target last changed
+	float rise_time;		// seconds to reach last target
+};
+
+#define CTL_NONE	0	// sensor control fan flags
+#define CTL_AVG		1
+#define CTL_TC0P	2
+#define CTL_TG0P	3
+
+extern struct sensor *sensors;
+extern int sensor_count;
+extern float temp_avg;
+extern int fan_speed;
+extern int fan_ctl;		// which sensor controls fan
+extern float input_avg;		// source temperatures after hysteresis, used by calc_speed()
+extern float input_TC0P;
+extern float input_TG0P;
+
+extern struct fan fans[MAX_FANS];
+extern int fan_count;
+extern float cycle_time;
+
+extern unsigned long sensor_reads;
+extern unsigned long read_errors;
+extern unsigned long fan_writes;
+extern unsigned long fan_writes_elided;
+extern unsigned long resumes;
+
+extern struct sensor *sensor_TC0P;
+extern struct sensor *sensor_TG0P;
+
 void find_applesmc();	// called once at startup, before anything else!
 void scan_sensors();
+void rediscover();		// after hwmon hotplug, never exits, fan_count is 0 while offline
 void adjust();
+void read_sensors();
+int sensor_polled(struct sensor *s);	// in temp_avg, bound, logged or traced
+void set_fan();		// writes fan_speed to every fan
+void control_resume(float hold);	// force a full read and fan rewrite after suspend
+void calc_avg();
+void calc_fan();
+struct profile;
+int calc_speed(struct profile *p, int *ctl);	// no side effects, see shadow.c
+void load_sensors(struct sensor *list, int count);
+extern double (*get_time)();	// monotonic, seconds
 void logger();
+char *ctl_name(int ctl);
 
 #endif /* CONTROL_H_ */
@@ -0,0 +1,364 @@
+/*
+ *  cpufreq.c -  Fan control daemon for MacBook
+ *
+ *  Copyright (C) 2010  Mikael Strom <mikael@sesamiq.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  Second actuator: when the fans are already at fan_max and the
+ *  temperature is still above its ceiling, lower scaling_max_freq in small
+ *  steps. Raise it again once the temperature has dropped cpufreq_hyst
+ *  degrees below the ceiling.
+ *
+ *  The uncapped value is read again before capping, so a limit set by an
+ *  admin meanwhile is kept, and only restored if we still own the value.
+ *  While capped, the original values are kept in CPUFREQ_STATE, so a run
+ *  that crashed or was killed has its cap undone at the next start.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <limits.h>
+#include "config.h"
+#include "control.h"
+#include "cpufreq.h"
+#include "hwmon.h"
+
+//------------------------------------------------------------------------------
+
+#define CPUFREQ_DIR		"/sys/devices/system/cpu/cpufreq"
+#define CPU_DIR			"/sys/devices/system/cpu"
+#define MAX_POLICIES	64
+#define CPUFREQ_STATE	"/var/run/macfanctld.cpufreq"	// path, original and capped kHz
+
+struct policy
+{
+	char path[PATH_MAX];	// directory holding scaling_max_freq
+	int hw_min;				// cpuinfo_min_freq, kHz
+	int hw_max;				// cpuinfo_max_freq, kHz
+	int orig_max;			// scaling_max_freq before capping, kHz
+	int written;			// last cap written, -1 when not capped
+};
+
+static struct policy policies[MAX_POLICIES];
+static int policy_count = 0;
+
+int cpufreq_cap_pct = 100;
+
+//------------------------------------------------------------------------------
+
+static int read_khz(char *dir, char *attr)
+{
+	char fname[PATH_MAX + 32];
+	char buf[32];
+	int val = -1;
+
+	snprintf(fname, sizeof(fname), "%s/%s", dir, attr);
+
+	int fd = open(fname, O_RDONLY);
+	if(fd > -1)
+	{
+		int n = read(fd, buf, sizeof(buf) - 1);
+		if(n > 0)
+		{
+			buf[n] = 0;
+			val = atoi(buf);
+		}
+		close(fd);
+	}
+
+	return val;
+}
+
+//------------------------------------------------------------------------------
+
+static void write_max_khz(struct policy *p, int khz)
+{
+	char fname[PATH_MAX + 32];
+	char buf[32];
+
+	snprintf(fname, sizeof(fname), "%s/scaling_max_freq", p->path);
+
+	int fd = open(fname, O_WRONLY);
+	if(fd < 0)
+	{
+		printf("Error: Can't open %s\n", fname);
+	}
+	else
+	{
+		sprintf(buf, "%d", khz);
+		if(write(fd, buf, strlen(buf)) < 0)
+		{
+			printf("Error: Can't write %s\n", fname);
+		}
+		close(fd);
+	}
+}
+
+//------------------------------------------------------------------------------
+
+static void add_policy(char *dir)
+{
+	if(policy_count >= MAX_POLICIES)
+	{
+		return;
+	}
+
+	struct policy *p = &policies[policy_count];
+
+	strncpy(p->path, dir, sizeof(p->path) - 1);
+	p->path[sizeof(p->path) - 1] = 0;
+
+	p->hw_min = read_khz(dir, "cpuinfo_min_freq");
+	p->hw_max = read_khz(dir, "cpuinfo_max_freq");
+	p->orig_max = read_khz(dir, "scaling_max_freq");
+	p->written = -1;
+
+	if(p->hw_min > 0 && p->hw_max > 0 && p->orig_max > 0)
+	{
+		++policy_count;
+	}
+}
+
+//------------------------------------------------------------------------------
+
+static void save_state()
+{
+	int i;
+
+	FILE *fp = fopen(CPUFREQ_STATE, "w");
+	if(fp == NULL)
+	{
+		return;
+	}
+
+	for(i = 0; i < policy_count; ++i)
+	{
+		if(policies[i].written > 0)
+		{
+			fprintf(fp, "%d %d %s\n", policies[i].orig_max, policies[i].written, policies[i].path);
+		}
+	}
+
+	fclose(fp);
+}
+
+//------------------------------------------------------------------------------
+// a previous run left a cap, undo it where the value is still the one it wrote
+
+static void undo_stale_cap()
+{
+	char path[PATH_MAX];
+	int orig;
+	int written;
+	int i;
+
+	FILE *fp = fopen(CPUFREQ_STATE, "r");
+	if(fp == NULL)
+	{
+		return;
+	}
+
+	while(fscanf(fp, "%d %d %4095s", &orig, &written, path) == 3)
+	{
+		for(i = 0; i < policy_count; ++i)
+		{
+			struct policy *p = &policies[i];
+
+			if(strcmp(p->path, path) == 0 && p->orig_max == written)
+			{
+				write_max_khz(p, orig);
+				p->orig_max = orig;
+
+				printf("Removed CPU frequency cap left by a previous run, %s\n", path);
+			}
+		}
+	}
+
+	fclose(fp);
+	unlink(CPUFREQ_STATE);
+}
+
+//------------------------------------------------------------------------------
+
+void find_cpufreq()
+{
+	DIR *fd_dir;
+	struct dirent *dir_entry;
+	char path[PATH_MAX + 320];
+	char dir[PATH_MAX + 32];
+
+	policy_count = 0;
+	cpufreq_cap_pct = 100;
+
+	// newer kernels group cpus sharing a clock into policyN directories
+
+	snprintf(dir, sizeof(dir), "%s" CPUFREQ_DIR, sysfs_root);
+	fd_dir = opendir(dir);
+	if(fd_dir != NULL)
+	{
+		while((dir_entry = readdir(fd_dir)) != NULL)
+		{
+			if(strncmp(dir_entry->d_name, "policy", 6) == 0)
+			{
+				snprintf(path, sizeof(path), "%s/%s", dir, dir_entry->d_name);
+				add_policy(path);
+			}
+		}
+		closedir(fd_dir);
+	}
+
+	// older kernels only have cpuN/cpufreq
+
+	if(policy_count == 0)
+	{
+		snprintf(dir, sizeof(dir), "%s" CPU_DIR, sysfs_root);
+		fd_dir = opendir(dir);
+		if(fd_dir != NULL)
+		{
+			while((dir_entry = readdir(fd_dir)) != NULL)
+			{
+				if(strncmp(dir_entry->d_name, "cpu", 3) == 0 &&
+				   dir_entry->d_name[3] >= '0' && dir_entry->d_name[3] <= '9')
+				{
+					snprintf(path, sizeof(path), "%s/%s/cpufreq", dir, dir_entry->d_name);
+					add_policy(path);
+				}
+			}
+			closedir(fd_dir);
+		}
+	}
+
+	printf("Found %d cpufreq policies.\n", policy_count);
+
+	undo_stale_cap();
+	fflush(stdout);
+}
+
+//------------------------------------------------------------------------------
+
+static void apply_cap()
+{
+	int i;
+
+	for(i = 0; i < policy_count; ++i)
+	{
+		struct policy *p = &policies[i];
+		int khz;
+
+		// not what we wrote: uncapped, or changed by someone else since.
+		// That value is the one to go back to
+
+		int cur = read_khz(p->path, "scaling_max_freq");
+
+		if(cur > 0 && cur != p->written)
+		{
+			p->orig_max = cur;
+			p->written = -1;
+		}
+
+		if(cpufreq_cap_pct >= 100)
+		{
+			if(p->written > 0)
+			{
+				write_max_khz(p, p->orig_max);
+			}
+			p->written = -1;
+			continue;
+		}
+
+		khz = (int)((long long)p->hw_max * cpufreq_cap_pct / 100);
+		khz = max(p->hw_min, khz);
+		khz = min(p->orig_max, khz);
+
+		write_max_khz(p, khz);
+		p->written = khz;
+	}
+
+	if(cpufreq_cap_pct < 100)
+	{
+		save_state();
+	}
+	else
+	{
+		unlink(CPUFREQ_STATE);
+	}
+
+	printf("CPU frequency cap: %d%%\n", cpufreq_cap_pct);
+	fflush(stdout);
+}
+
+//------------------------------------------------------------------------------
+
+void cpufreq_adjust()
+{
+	float temp;
+	float ceiling;
+	int cap = cpufreq_cap_pct;
+
+	if(policy_count == 0)
+	{
+		return;
+	}
+
+	// applesmc offline: no fan is driven by us, nothing justifies a cap
+
+	if(! cpufreq_cap || fan_count == 0)
+	{
+		cpufreq_restore();
+		return;
+	}
+
+	// TC0P is the reference if present, the average otherwise
+
+	if(sensor_TC0P != NULL)
+	{
+		temp = sensor_TC0P->value;
+		ceiling = profile->temp_TC0P_ceiling;
+	}
+	else
+	{
+		temp = temp_avg;
+		ceiling = profile->temp_avg_ceiling;
+	}
+
+	if(fan_speed >= fan_max && temp > ceiling)
+	{
+		cap = max(cpufreq_floor, cap - cpufreq_step);	// out of fan, step down
+	}
+	else if(temp < ceiling - cpufreq_hyst)
+	{
+		cap = min(100, cap + cpufreq_step);				// cooled off, step up
+	}
+
+	if(cap != cpufreq_cap_pct)
+	{
+		cpufreq_cap_pct = cap;
+		apply_cap();
+	}
+}
+
+//------------------------------------------------------------------------------
+
+void cpufreq_restore()
+{
+	if(cpufreq_cap_pct < 100)
+	{
+		cpufreq_cap_pct = 100;
+		apply_cap();
+	}
+}
+
+//------------------------------------------------------------------------------
@@ -0,0 +1,26 @@
+/*
+ *  cpufreq.h -  Fan control daemon for MacBook
+ *
+ *  Copyright (C) 2010  Mikael Strom <mikael@sesamiq.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ */
+
+#ifndef CPUFREQ_H_
+#define CPUFREQ_H_
+
+extern int cpufreq_cap_pct;		// current cap in percent of cpuinfo_max_freq
+
+void find_cpufreq();	// called once at startup
+void cpufreq_adjust();	// called after fan speed is calculated
+void cpufreq_restore();	// put back the original scaling_max_freq
+
+#endif /* CPUFREQ_H_ */
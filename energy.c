@@ -0,0 +1,329 @@
+/*
+ *  energy.c -  Fan control daemon for MacBook
+ *
+ *  Copyright (C) 2010  Mikael Strom <mikael@sesamiq.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  Energy optimizer, fan_optimize. A hot package leaks more, a fast fan
+ *  draws more, somewhere between is a speed using the least total power.
+ *  Once the ramp speed is steady, the speed is perturbed by optimize_step
+ *  every optimize_dwell seconds and kept going the same way as long as
+ *  package power (RAPL energy_uj) plus estimated fan power, fan_power at
+ *  fan_max and cubic in speed, goes down. Power is measured over the second
+ *  half of each dwell, after the temperatures have followed the step.
+ *
+ *  The optimizer only runs faster than the ramp, never slower, so the
+ *  ceilings hold as before. A source within optimize_margin of its ceiling,
+ *  a faster ramp speed or a jump in package power (load change) restart
+ *  the search from the ramp speed, whose power is the reference for the
+ *  watts saved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include "config.h"
+#include "control.h"
+#include "hwmon.h"
+#include "energy.h"
+
+//------------------------------------------------------------------------------
+
+#define RAPL_DIR		"/sys/class/powercap"
+#define MAX_PACKAGES	4
+#define LOAD_CHANGE		0.2		// relative package power change seen as new load
+
+static char energy_path[MAX_PACKAGES][PATH_MAX + 64];
+static double energy_range[MAX_PACKAGES];
+static int package_count = 0;
+
+int opt_speed = -1;
+float package_power = -1;
+float power_saved = 0;
+
+static int dir;					// +1 or -1, direction of the next step
+static double dwell_start;
+static int measuring;
+static double e_start;			// energy at start of measurement, uJ
+static double t_start;
+static float last_total;		// watts of the previous dwell, -1 if none
+static float reference;			// watts at the ramp speed, -1 if unknown
+static int turned;				// search has reversed, found the minimum
+
+//------------------------------------------------------------------------------
+// energy_uj and max_energy_range_uj overflow int, read_attr() can't be used
+
+static int read_u64(char *fname, double *val)
+{
+	char buf[32];
+
+	int fd = open(fname, O_RDONLY);
+	if(fd < 0)
+	{
+		return -1;
+	}
+
+	int n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+
+	if(n < 1)
+	{
+		return -1;
+	}
+	buf[n] = 0;
+
+	*val = strtoull(buf, NULL, 10);
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+void optimize_restart()
+{
+	opt_speed = -1;
+	last_total = -1;
+	reference = -1;
+	measuring = 0;
+	turned = 0;
+}
+
+//------------------------------------------------------------------------------
+
+void find_rapl()
+{
+	int i;
+
+	package_count = 0;
+
+	for(i = 0; i < MAX_PACKAGES; ++i)
+	{
+		char fname[PATH_MAX + 96];
+		double val;
+
+		snprintf(energy_path[package_count], sizeof(energy_path[0]),
+				 "%s" RAPL_DIR "/intel-rapl:%d/energy_uj", sysfs_root, i);
+		snprintf(fname, sizeof(fname), "%s" RAPL_DIR "/intel-rapl:%d/max_energy_range_uj", sysfs_root, i);
+
+		if(read_u64(energy_path[package_count], &val) == 0 && read_u64(fname, &val) == 0)
+		{
+			energy_range[package_count++] = val;
+		}
+	}
+
+	if(fan_optimize)
+	{
+		if(package_count > 0)
+		{
+			printf("Found %d RAPL packages, optimizing fan power.\n", package_count);
+		}
+		else
+		{
+			printf("No RAPL energy counters, fan_optimize is off.\n");
+		}
+		fflush(stdout);
+	}
+
+	// counters and reference from the old set, or the old config, are stale
+
+	optimize_restart();
+}
+
+//------------------------------------------------------------------------------
+// total package energy, uJ, -1 on error
+
+static double package_energy()
+{
+	double sum = 0;
+	int i;
+
+	for(i = 0; i < package_count; ++i)
+	{
+		double val;
+
+		if(read_u64(energy_path[i], &val) != 0)
+		{
+			return -1;
+		}
+		sum += val;
+	}
+
+	return sum;
+}
+
+//------------------------------------------------------------------------------
+
+static float fan_power_now()
+{
+	float sum = 0;
+	int i;
+
+	for(i = 0; i < fan_count; ++i)
+	{
+		float r = fans[i].actual / fan_max;
+		sum += fan_power * r * r * r;
+	}
+
+	return sum;
+}
+
+//------------------------------------------------------------------------------
+
+static int near_ceiling()
+{
+	return temp_avg > profile->temp_avg_ceiling - optimize_margin ||
+		   (sensor_TC0P != NULL && sensor_TC0P->value > profile->temp_TC0P_ceiling - optimize_margin) ||
+		   (sensor_TG0P != NULL && sensor_TG0P->value > profile->temp_TG0P_ceiling - optimize_margin);
+}
+
+//------------------------------------------------------------------------------
+// power over the second half of the dwell, -1 if not done yet
+
+static float measure(double now)
+{
+	double e = package_energy();
+
+	if(e < 0)
+	{
+		measuring = 0;
+		dwell_start = now;
+		return -1;
+	}
+
+	if(! measuring)
+	{
+		if(now - dwell_start >= optimize_dwell / 2.0)
+		{
+			e_start = e;
+			t_start = now;
+			measuring = 1;
+		}
+		return -1;
+	}
+
+	if(now - dwell_start < optimize_dwell)
+	{
+		return -1;
+	}
+
+	double de = e - e_start;
+	double range = 0;
+	int i;
+
+	for(i = 0; i < package_count; ++i)
+	{
+		range += energy_range[i];
+	}
+
+	if(de < 0)
+	{
+		de += range;		// counter wrapped
+	}
+
+	measuring = 0;
+	dwell_start = now;
+
+	return now > t_start ? de / 1e6 / (now - t_start) : -1;
+}
+
+//------------------------------------------------------------------------------
+
+// search again from the ramp speed, logs what the last search achieved
+
+static void begin(int speed, double now)
+{
+	if(turned && power_saved > 0 && log_level > 0)
+	{
+		printf("Optimizer restarted at %d rpm, was saving %.2fW\n", speed, power_saved);
+	}
+
+	optimize_restart();
+	opt_speed = speed;
+	dir = 1;
+	dwell_start = now;
+}
+
+//------------------------------------------------------------------------------
+
+int optimize_speed(int speed)
+{
+	double now = get_time();
+
+	if(! fan_optimize || package_count == 0 || fan_mode == MODE_PID)
+	{
+		opt_speed = -1;
+		return speed;
+	}
+
+	if(opt_speed < 0 || speed > opt_speed || near_ceiling())
+	{
+		begin(speed, now);
+		return speed;
+	}
+
+	float pkg = measure(now);
+
+	if(pkg < 0)
+	{
+		return opt_speed;
+	}
+
+	float total = pkg + fan_power_now();
+	float change = pkg - package_power;
+
+	if(last_total >= 0 && (change > LOAD_CHANGE * package_power || change < -LOAD_CHANGE * package_power))
+	{
+		// new load, the comparison is meaningless
+
+		begin(speed, now);
+		package_power = pkg;
+		return speed;
+	}
+
+	if(reference < 0)
+	{
+		reference = total;		// first dwell is at the ramp speed
+	}
+	else if(total > last_total)
+	{
+		dir = -dir;
+
+		// the previous step was the best so far
+
+		int best = opt_speed + dir * optimize_step;
+
+		if(! turned && best > speed && reference > last_total && log_level > 0)
+		{
+			printf("Optimizer settled at %d rpm (ramp %d), package %.1fW, saving %.2fW\n",
+				   best, speed, package_power, reference - last_total);
+		}
+		turned = 1;
+	}
+
+	package_power = pkg;
+	power_saved = reference - total;
+	last_total = total;
+
+	if(log_level > 1)
+	{
+		printf("Optimizer: %d rpm (ramp %d), package %.1fW, fans %.1fW, saved %.2fW\n",
+			   opt_speed, speed, pkg, total - pkg, power_saved);
+	}
+
+	opt_speed = max(speed, min((int)fan_max, opt_speed + dir * optimize_step));
+
+	return opt_speed;
+}
+
+//------------------------------------------------------------------------------
@@ -0,0 +1,28 @@
+/*
+ *  energy.h -  Fan control daemon for MacBook
+ *
+ *  Copyright (C) 2010  Mikael Strom <mikael@sesamiq.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ */
+
+#ifndef ENERGY_H_
+#define ENERGY_H_
+
+extern int opt_speed;			// speed the optimizer holds, -1 if idle
+extern float package_power;		// watts, last dwell, -1 if unknown
+extern float power_saved;		// watts below the ramp speed, last dwell
+
+void find_rapl();				// after find_applesmc(), resets the search
+int optimize_speed(int speed);	// from calc_fan(), returns the speed to use
+void optimize_restart();		// after scan_sensors(), search again from the ramp speed
+
+#endif /* ENERGY_H_ */
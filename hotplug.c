@@ -0,0 +1,171 @@
+/*
+ *  hotplug.c -  Fan control daemon for MacBook
+ *
+ *  Copyright (C) 2010  Mikael Strom <mikael@sesamiq.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  Notices hwmon devices being added or removed, i.e. when applesmc is
+ *  reloaded, by listening to kernel uevents. The socket is non blocking and
+ *  drained once per cycle, an overrun (ENOBUFS) counts as a change. Without
+ *  netlink, the chip directories are checked every cycle, a recreated one
+ *  has a new inode. While applesmc is offline, rediscovery is retried every
+ *  minute either way.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include "hwmon.h"
+#include "control.h"
+#include "hotplug.h"
+
+//------------------------------------------------------------------------------
+
+#define RETRY_CYCLES	12		// rediscovery interval while offline
+
+static int sock = -1;
+static ino_t chip_ino[MAX_CHIPS];	// inode of each chip directory
+static int known_chips = -1;		// chips in chip_ino, -1 after a change
+
+//------------------------------------------------------------------------------
+
+void hotplug_open()
+{
+	struct sockaddr_nl addr;
+
+	sock = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+	if(sock < 0)
+	{
+		printf("Hotplug events unavailable, checking hwmon devices every cycle.\n");
+		return;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_pid = 0;
+	addr.nl_groups = 1;			// kernel events, not udev
+
+	if(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+	{
+		printf("Hotplug events unavailable, checking hwmon devices every cycle.\n");
+		close(sock);
+		sock = -1;
+	}
+}
+
+//------------------------------------------------------------------------------
+// uevent: "action@devpath" followed by KEY=value strings, all 0 terminated
+
+static int is_hwmon_event(char *buf, int len)
+{
+	char *p = buf;
+	int hwmon = 0;
+
+	if(strncmp(buf, "add@", 4) != 0 && strncmp(buf, "remove@", 7) != 0)
+	{
+		return 0;
+	}
+
+	while(p < buf + len)
+	{
+		if(strcmp(p, "SUBSYSTEM=hwmon") == 0)
+		{
+			hwmon = 1;
+		}
+		p += strlen(p) + 1;
+	}
+
+	return hwmon;
+}
+
+//------------------------------------------------------------------------------
+
+// a chip directory gone or recreated at the same path, i.e. a reload
+
+static int chips_changed()
+{
+	struct stat buf;
+	int i;
+
+	for(i = 0; i < chip_count; ++i)
+	{
+		if(stat(chips[i].path, &buf) != 0 ||
+		   (known_chips == chip_count && buf.st_ino != chip_ino[i]))
+		{
+			known_chips = -1;
+			return 1;
+		}
+		chip_ino[i] = buf.st_ino;
+	}
+
+	known_chips = chip_count;
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+int hotplug_changed()
+{
+	static unsigned int cycle = 0;
+	char buf[4096];
+	int changed = 0;
+	int n;
+
+	if(fan_count == 0 && ++cycle % RETRY_CYCLES == 0)
+	{
+		changed = 1;		// offline, applesmc may be back without us hearing
+	}
+
+	if(sock < 0)
+	{
+		return chips_changed() || changed;
+	}
+
+	for(;;)
+	{
+		n = recv(sock, buf, sizeof(buf) - 1, 0);
+
+		if(n > 0)
+		{
+			buf[n] = 0;
+			changed |= is_hwmon_event(buf, n);
+		}
+		else if(n < 0 && errno == ENOBUFS)
+		{
+			changed = 1;	// events were dropped, can't tell which
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	return changed;
+}
+
+//------------------------------------------------------------------------------
+
+void hotplug_close()
+{
+	if(sock > -1)
+	{
+		close(sock);
+		sock = -1;
+	}
+}
+
+//------------------------------------------------------------------------------
@@ -0,0 +1,24 @@
+/*
+ *  hotplug.h -  Fan control daemon for MacBook
+ *
+ *  Copyright (C) 2010  Mikael Strom <mikael@sesamiq.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ */
+
+#ifndef HOTPLUG_H_
+#define HOTPLUG_H_
+
+void hotplug_open();		// called once at startup
+int hotplug_changed();		// called every cycle, 1 if hwmon devices came or went
+void hotplug_close();
+
+#endif /* HOTPLUG_H_ */
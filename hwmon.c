@@ -0,0 +1,275 @@
+/*
+ *  hwmon.c -  Fan control daemon for MacBook
+ *
+ *  Copyright (C) 2010  Mikael Strom <mikael@sesamiq.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  Discovery of the hwmon chips we can read temperatures from, and the
+ *  sysfs attribute access used for all sensor and fan I/O.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include "hwmon.h"
+
+//------------------------------------------------------------------------------
+
+#define HWMON_DIR		"/sys/class/hwmon"
+
+char sysfs_root[PATH_MAX] = "";	// prefix for all sysfs paths, set by simulator
+
+// chips we know how to use, everything else is ignored. notify is set for
+// drivers signalling alarm changes with sysfs_notify(), see alarm.c
+
+struct known_chip
+{
+	char *name;
+	int notify;
+};
+
+struct known_chip known_chips[] =
+{
+	{"applesmc", 0},	// SMC, slow bus transactions, also drives the fans
+	{"coretemp", 0},	// Intel per core die temp, cheap MSR reads
+	{"drivetemp", 0},	// SATA drive temp
+	{"acpitz", 0},		// ACPI thermal zone
+	{"lm90", 1},		// LM90 family remote diode sensors, writable limits
+	{"lm86", 1},
+	{"lm89", 1},
+	{"lm99", 1},
+	{"adm1032", 1},
+	{"adt7461", 1},
+	{"max6657", 1},
+	{"max6658", 1},
+	{"max6659", 1},
+	{"max6646", 1},
+	{"max6695", 1},
+	{"max6696", 1},
+	{"nct1008", 1},
+	{"tmp451", 1},
+	{"g781", 1}
+};
+#define N_KNOWN			(sizeof(known_chips) / sizeof(known_chips[0]))
+
+struct chip chips[MAX_CHIPS];
+int chip_count = 0;
+struct chip *chip_applesmc = NULL;
+
+//------------------------------------------------------------------------------
+// read the chip name from 'dir/name', strip trailing newline
+
+static int read_name(char *dir, char *name, int size)
+{
+	char fname[PATH_MAX + 352];
+	int ret = -1;
+
+	snprintf(fname, sizeof(fname), "%s/name", dir);
+
+	int fd = open(fname, O_RDONLY);
+	if(fd > -1)
+	{
+		int n = read(fd, name, size - 1);
+		if(n > 0)
+		{
+			name[n] = 0;
+
+			char *p_endl = strchr(name, '\n');
+			if(p_endl)
+			{
+				*p_endl = 0;
+			}
+			ret = 0;
+		}
+		close(fd);
+	}
+
+	return ret;
+}
+
+//------------------------------------------------------------------------------
+// newer kernels keep the attributes in hwmonN, older ones in hwmonN/device
+
+static void add_chip(char *hwmon_path)
+{
+	char dir[PATH_MAX + 336];
+	char name[CHIPNAME_MAXLEN];
+	int i;
+
+	if(chip_count >= MAX_CHIPS)
+	{
+		return;
+	}
+
+	strcpy(dir, hwmon_path);
+	if(read_name(dir, name, sizeof(name)) != 0)
+	{
+		snprintf(dir, sizeof(dir), "%s/device", hwmon_path);
+		if(read_name(dir, name, sizeof(name)) != 0)
+		{
+			return;
+		}
+	}
+
+	for(i = 0; i < N_KNOWN; ++i)
+	{
+		if(strcmp(name, known_chips[i].name) == 0)
+		{
+			char *dev_path = realpath(dir, NULL);
+
+			if(dev_path != NULL)
+			{
+				struct chip *c = &chips[chip_count++];
+
+				strncpy(c->name, name, sizeof(c->name) - 1);
+				c->name[sizeof(c->name) - 1] = 0;
+				strncpy(c->path, dev_path, sizeof(c->path) - 1);
+				c->path[sizeof(c->path) - 1] = 0;
+				c->poll_div = 1;
+				c->notify = known_chips[i].notify;
+
+				free(dev_path);
+
+				printf("Found %s at %s\n", c->name, c->path);
+			}
+			break;
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+
+void find_chips()
+{
+	DIR *fd_dir;
+	int i;
+
+	chip_count = 0;
+	chip_applesmc = NULL;
+
+	char hwmon_dir[PATH_MAX + 32];
+
+	snprintf(hwmon_dir, sizeof(hwmon_dir), "%s" HWMON_DIR, sysfs_root);
+
+	fd_dir = opendir(hwmon_dir);
+
+	if(fd_dir != NULL)
+	{
+		struct dirent *dir_entry;
+
+		while((dir_entry = readdir(fd_dir)) != NULL)
+		{
+			if(dir_entry->d_name[0] != '.')
+			{
+				char hwmon_path[PATH_MAX + 320];
+
+				snprintf(hwmon_path, sizeof(hwmon_path), "%s/%s", hwmon_dir, dir_entry->d_name);
+				add_chip(hwmon_path);
+			}
+		}
+		closedir(fd_dir);
+	}
+
+	// only the first applesmc is used, it's the one with the fans
+
+	for(i = 0; i < chip_count && chip_applesmc == NULL; ++i)
+	{
+		if(strcmp(chips[i].name, "applesmc") == 0)
+		{
+			chip_applesmc = &chips[i];
+		}
+	}
+
+	fflush(stdout);
+}
+
+//------------------------------------------------------------------------------
+
+struct chip *find_chip(char *name)
+{
+	int i;
+
+	for(i = 0; i < chip_count; ++i)
+	{
+		if(strcmp(chips[i].name, name) == 0)
+		{
+			return &chips[i];
+		}
+	}
+
+	return NULL;
+}
+
+//------------------------------------------------------------------------------
+
+int read_attr(char *fname, int *val)
+{
+	char val_buf[16];
+
+	int fd = open(fname, O_RDONLY);
+	if(fd < 0)
+	{
+		printf("Error: Can't open %s\n", fname);
+		fflush(stdout);
+		return -1;
+	}
+
+	int n = read(fd, val_buf, sizeof(val_buf) - 1);
+	close(fd);
+
+	if(n < 1)
+	{
+		printf("Error: Can't read  %s\n", fname);
+		fflush(stdout);
+		return -1;
+	}
+
+	val_buf[n] = 0;
+	*val = atoi(val_buf);
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+int write_attr(char *fname, int val)
+{
+	char buf[16];
+
+	int fd = open(fname, O_WRONLY);
+	if(fd < 0)
+	{
+		printf("Error: Can't open %s\n", fname);
+		fflush(stdout);
+		return -1;
+	}
+
+	sprintf(buf, "%d", val);
+	int n = write(fd, buf, strlen(buf));
+	close(fd);
+
+	if(n < 0)
+	{
+		printf("Error: Can't write %s\n", fname);
+		fflush(stdout);
+		return -1;
+	}
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------
@@ -0,0 +1,45 @@
+/*
+ *  hwmon.h -  Fan control daemon for MacBook
+ *
+ *  Copyright (C) 2010  Mikael Strom <mikael@sesamiq.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ */
+
+#ifndef HWMON_H_
+#define HWMON_H_
+
+#include <limits.h>
+
+#define CHIPNAME_MAXLEN	32
+#define MAX_CHIPS		16
+
+struct chip
+{
+	char name[CHIPNAME_MAXLEN];	// driver name, i.e. applesmc or coretemp
+	char path[PATH_MAX];		// directory holding the tempN_* attributes
+	int poll_div;				// read this chip every poll_div cycles
+	int notify;					// driver raises POLLPRI on tempN_*_alarm
+};
+
+extern char sysfs_root[PATH_MAX];
+
+extern struct chip chips[MAX_CHIPS];
+extern int chip_count;
+extern struct chip *chip_applesmc;	// NULL if not found
+
+void find_chips();
+struct chip *find_chip(char *name);
+
+int read_attr(char *fname, int *val);	// returns 0 on success
+int write_attr(char *fname, int val);
+
+#endif /* HWMON_H_ */
@@ -26,11 +26,25 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <time.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <syslog.h>
 
 #include "control.h"
 #include "config.h"
+#include "cpufreq.h"
+#include "trace.h"
+#include "metrics.h"
+#include "power.h"
+#include "hotplug.h"
+#include "shadow.h"
+#include "probes.h"
+#include "stats.h"
+#include "autotune.h"
+#include "alarm.h"
+#include "energy.h"
 
 //------------------------------------------------------------------------------
 
@@ -38,9 +52,18 @@
 #define LOG_FILE	"/var/log/macfanctl.log"
 #define CFG_FILE	"/etc/macfanctl.conf"
 
+#define CYCLE_TIME		5		// seconds between adjust()
+#define RESUME_CYCLES	10		// short cycles after resume
+#define RESUME_CYCLE	1
+
+char cfg_file[PATH_MAX] = CFG_FILE;
+char trace_file[PATH_MAX] = "";
+
 int running = 1;
 int lock_fd = -1;
 int reload = 0;
+int reopen = 0;
+int dump_stats = 0;
 
 //------------------------------------------------------------------------------
 
@@ -51,6 +74,12 @@ void signal_handler(int sig)
 	case SIGHUP:
 		reload = 1;
 		break;
+	case SIGUSR1:
+		reopen = 1;
+		break;
+	case SIGUSR2:
+		dump_stats = 1;
+		break;
 	case SIGINT:
 	case SIGTERM:
 		running = 0;
@@ -58,6 +87,17 @@ void signal_handler(int sig)
 	}
 }
 
+//-----------------------------------------------------------------------------
+// append, so restarts don't truncate and logrotate can move the file away
+
+void open_log()
+{
+	if(freopen(LOG_FILE, "a", stdout) != NULL)
+	{
+		setvbuf(stdout, NULL, _IOFBF, BUFSIZ);	// flushed every log_flush seconds
+	}
+}
+
 //-----------------------------------------------------------------------------
 
 void daemonize()
@@ -88,7 +128,7 @@ void daemonize()
 	umask(022); // set createfile permissions
 #endif
 
-	freopen(LOG_FILE, "w", stdout);
+	open_log();
 	freopen("/dev/null", "r", stdin);
 
 	chdir("/");
@@ -110,21 +150,129 @@ void daemonize()
 	write(lock_fd, str, strlen(str));
 }
 
+//-----------------------------------------------------------------------------
+// the daemon keeps PID_FILE locked while it runs
+
+int daemon_running()
+{
+	int fd = open(PID_FILE, O_RDONLY);
+
+	if(fd < 0)
+	{
+		return 0;
+	}
+
+	int locked = lockf(fd, F_TEST, 0) < 0 && (errno == EACCES || errno == EAGAIN);
+
+	close(fd);
+
+	return locked;
+}
+
+//-----------------------------------------------------------------------------
+// time spent in suspend, CLOCK_BOOTTIME counts it, CLOCK_MONOTONIC doesn't
+
+double suspended_time()
+{
+	struct timespec boot;
+	struct timespec mono;
+
+	clock_gettime(CLOCK_BOOTTIME, &boot);
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+
+	return (boot.tv_sec - mono.tv_sec) + (boot.tv_nsec - mono.tv_nsec) / 1e9;
+}
+
+//-----------------------------------------------------------------------------
+// sleep on CLOCK_BOOTTIME, a wait spanning a suspend ends right at resume
+// instead of sleeping out the remaining time. Returns seconds suspended,
+// 0 if there was no suspend since the last call. Signals and temperature
+// alarms end the wait early, alarm is set for the latter.
+
+double wait_cycle(int seconds, int *alarm)
+{
+	static double last_suspended = -1;
+	struct timespec ts;
+
+	if(last_suspended < 0)
+	{
+		last_suspended = suspended_time();
+	}
+
+	clock_gettime(CLOCK_BOOTTIME, &ts);
+	ts.tv_sec += seconds;
+
+	*alarm = alarm_wait(&ts);
+
+	if(*alarm < 0)
+	{
+		*alarm = 0;
+
+		int err = clock_nanosleep(CLOCK_BOOTTIME, TIMER_ABSTIME, &ts, NULL);
+		if(err != 0 && err != EINTR)
+		{
+			sleep(seconds);		// old kernel, resume is still detected next cycle
+		}
+	}
+
+	double suspended = suspended_time();
+	double slept = suspended - last_suspended;
+
+	last_suspended = suspended;
+
+	return slept > 1 ? slept : 0;	// ignore clock adjustment noise
+}
+
 //-----------------------------------------------------------------------------
 
 void usage()
 {
-	printf("usage: macfanctld [-f]\n");
+	printf("usage: macfanctld [-f] [-c config] [-t trace]\n");
+	printf("       macfanctld -r trace [-c config] [-v]\n");
+	printf("       macfanctld --autotune fragment [-c config]\n");
 	printf("  -f  run in foregound\n");
+	printf("  -c  use config instead of %s\n", CFG_FILE);
+	printf("  -t  capture sensor readings and fan decisions to trace\n");
+	printf("  -r  replay trace through the control code using config, then exit\n");
+	printf("  -v  print every differing decision when replaying\n");
+	printf("  --autotune  load the CPUs, step the fans and write tuned settings to fragment\n");
 	exit(-1);
 }
 
+//-----------------------------------------------------------------------------
+// daemonize() changes dir to /, make relative file names absolute first
+
+void abs_path(char *dst, char *src)
+{
+	char cwd[PATH_MAX];
+
+	int len;
+
+	if(src[0] != '/' && getcwd(cwd, sizeof(cwd)) != NULL)
+	{
+		len = snprintf(dst, PATH_MAX, "%s/%s", cwd, src);
+	}
+	else
+	{
+		len = snprintf(dst, PATH_MAX, "%s", src);
+	}
+
+	if(len >= PATH_MAX)
+	{
+		printf("Error: Path too long: %s\n", src);
+		exit(-1);
+	}
+}
+
 //-----------------------------------------------------------------------------
 
 int main(int argc, char *argv[])
 {
 	int i;
 	int daemon = 1;
+	int verbose = 0;
+	char *replay = NULL;
+	char *tune = NULL;
 
 	// setup daemon
 	signal(SIGCHLD, SIG_IGN); 			// ignore child
@@ -134,6 +282,8 @@ int main(int argc, char *argv[])
 	signal(SIGINT, signal_handler); 	// catch Ctrl-C signal (terminating in foreground mode)
 	signal(SIGHUP, signal_handler); 	// catch hangup signal (reload config)
 	signal(SIGTERM, signal_handler); 	// catch kill signal
+	signal(SIGUSR1, signal_handler); 	// catch user signal (reopen log file)
+	signal(SIGUSR2, signal_handler); 	// catch user signal (print statistics)
 
 	for(i = 1; i < argc; ++i)
 	{
@@ -141,12 +291,56 @@ int main(int argc, char *argv[])
 		{
 			daemon = 0;
 		}
+		else if(strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+		{
+			abs_path(cfg_file, argv[++i]);
+		}
+		else if(strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+		{
+			abs_path(trace_file, argv[++i]);
+		}
+		else if(strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+		{
+			replay = argv[++i];
+		}
+		else if(strcmp(argv[i], "-v") == 0)
+		{
+			verbose = 1;
+		}
+		else if(strcmp(argv[i], "--autotune") == 0 && i + 1 < argc)
+		{
+			tune = argv[++i];
+		}
 		else
 		{
 			usage();
 		}
 	}
 
+	if(replay != NULL)
+	{
+		// offline, no daemon and no hardware access
+
+		read_cfg(cfg_file);
+		return trace_replay(replay, verbose) == 0 ? 0 : 1;
+	}
+
+	if(tune != NULL)
+	{
+		// foreground, takes over the fans for some minutes, then exits
+
+		if(daemon_running())
+		{
+			printf("Error: macfanctld is running, stop it first\n");
+			return 1;
+		}
+
+		read_cfg(cfg_file);
+		find_applesmc();
+		scan_sensors();
+		return autotune(tune, &running) == 0 ? 0 : 1;
+	}
+
 	if(daemon)
 	{
 		daemonize();
@@ -156,30 +350,107 @@ int main(int argc, char *argv[])
 		printf("Running in foreground, log to stdout.\n");
 	}
 
+	openlog("macfanctld", LOG_PID, LOG_DAEMON);
+
 	// main loop
 
-	read_cfg(CFG_FILE);
+	read_cfg(cfg_file);
+	shadow_load();
 
 	find_applesmc();
 	scan_sensors();
+	find_cpufreq();
+	find_power_supplies();
+	find_rapl();
+	hotplug_open();
+	alarm_open();
+
+	if(trace_file[0] != 0)
+	{
+		trace_open(trace_file);
+		trace_header();
+	}
+
+	int burst = 0;
 
 	running = 1;
 	while(running)
 	{
+		if(hotplug_changed())
+		{
+			rediscover();
+			alarm_open();
+			trace_header();
+		}
+
+		select_profile();
+		alarm_profile();
 		adjust();
+		shadow_eval();
+		stats_update();
+		cpufreq_adjust();
+		trace_sample();
+		metrics_export();
 
 		logger();
 
+		if(dump_stats)
+		{
+			stats_print();
+			dump_stats = 0;
+		}
+
+		if(reopen)
+		{
+			if(daemon)
+			{
+				fflush(stdout);
+				open_log();
+			}
+			reopen = 0;
+		}
+
 		if(reload)
 		{
-			read_cfg(CFG_FILE);
-			scan_sensors();
+			shadow_report();
+			read_cfg(cfg_file);
+			shadow_load();
+			rediscover();
+			alarm_open();
+			find_rapl();
+			trace_header();
+			++config_reloads;
+			PROBE1(config_reload, config_reloads);
 			reload = 0;
 		}
 
-		sleep(5);
+		int alarm;
+		double suspended = wait_cycle(burst > 0 ? RESUME_CYCLE : CYCLE_TIME, &alarm);
+
+		if(suspended > 0)
+		{
+			printf("Resumed after %.0fs suspend.\n", suspended);
+			fflush(stdout);
+
+			control_resume(RESUME_CYCLES * RESUME_CYCLE);
+			burst = RESUME_CYCLES;
+		}
+		else if(alarm)
+		{
+			burst = RESUME_CYCLES;		// adjust now, then follow the spike closely
+		}
+		else if(burst > 0)
+		{
+			--burst;
+		}
 	}
 
+	shadow_report();
+	cpufreq_restore();
+	trace_close();
+	hotplug_close();
+	alarm_close();
+
 	// close pid file and delete it
 
 	if(lock_fd != -1)
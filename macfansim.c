@@ -0,0 +1,613 @@
+/*
+ *  macfansim.c -  Thermal plant simulator for macfanctld
+ *
+ *  Copyright (C) 2010  Mikael Strom <mikael@sesamiq.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  Note:
+ *  Runs the real control code against a simulated applesmc. A fake sysfs
+ *  tree is created in /tmp, each sensor is a first order thermal system
+ *  heated by a workload profile and cooled by the fan speed. Time is
+ *  simulated, so an hour of control takes a fraction of a second.
+ *
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "control.h"
+#include "config.h"
+#include "hwmon.h"
+#include "autotune.h"
+#include "energy.h"
+
+//------------------------------------------------------------------------------
+
+#define T_STEP			1.0		// plant integration step, seconds
+#define FAN_HW_MIN		2000	// the SMC never runs the fans slower
+#define FAN_TAU			2.0		// fan spin up/down time constant, seconds
+#define SETTLE_BAND		1.0		// degrees, settled when within of final temp
+
+// package power: PKG_IDLE + load * PKG_LOAD + leakage, which grows
+// exponentially with die (TC0D) temperature. Fans draw FAN_POWER at 6200 rpm
+// each, cubic in speed
+
+#define PKG_IDLE		3.0		// watts
+#define PKG_LOAD		25.0
+#define PKG_LEAK		2.0		// leakage at PKG_LEAK_T0
+#define PKG_LEAK_T0		50.0
+#define PKG_LEAK_T		20.0	// degrees per factor e
+#define FAN_POWER		1.5
+#define RAPL_RANGE		262143328850.0	// max_energy_range_uj
+
+// steady state: T = t_amb + (idle + load * load_gain) / (1 + cool * rpm / 6200)
+
+struct plant
+{
+	char *key;
+	float idle;			// temp rise at idle with no cooling
+	float load_gain;	// extra temp rise at full load
+	float cool;			// cooling effect of a full speed fan
+	float tau;			// time constant, seconds
+	float temp;
+}
+plant[] =
+{
+	{"TB0T",  5,  3, 0.2, 600},
+	{"TC0D", 20, 55, 1.0,   5},
+	{"TC0P", 15, 45, 1.0,  30},
+	{"TG0P", 15, 20, 0.8,  60},
+	{"TN0P", 12, 10, 0.6,  90},
+	{"Ts0P",  6,  4, 0.2, 400}
+};
+#define N_PLANT			(sizeof(plant) / sizeof(plant[0]))
+
+// workload profiles, list of {seconds, load} ended by {0, 0}
+
+struct segment
+{
+	int duration;
+	float load;
+};
+
+struct scenario
+{
+	char *name;
+	struct segment seg[8];
+}
+scenarios[] =
+{
+	{"idle",		{{1800, 0.05}, {0, 0}}},
+	{"burst",		{{300, 0.05}, {600, 1.0}, {1500, 0.05}, {0, 0}}},
+	{"sustained",	{{120, 0.05}, {3480, 0.9}, {0, 0}}},
+	{"sawtooth",	{{300, 0.05}, {120, 0.8}, {120, 0.1}, {120, 0.8}, {120, 0.1},
+					 {120, 0.8}, {600, 0.05}, {0, 0}}}
+};
+#define N_SCENARIOS		(sizeof(scenarios) / sizeof(scenarios[0]))
+
+struct result
+{
+	float peak;				// hottest TC0P or TG0P seen
+	float above;			// seconds any source is above its ceiling
+	float settle;			// seconds from last load change until TC0P settled
+	float rpm_mean;			// mean fan 1 speed
+	float rpm_sd;			// standard deviation of fan 1 speed
+	float writes_h;			// fan writes per hour
+	float changes_h;		// fan speed changes per hour
+	float power;			// mean package plus fan power, watts
+};
+
+static char root[PATH_MAX];
+static char dev[PATH_MAX + 64];
+static double sim_time = 0;
+static float t_amb = 25;
+static int period = 5;
+static float rpm[MAX_FANS];
+static float tune_level = 0;	// plant load during --autotune
+static char rapl[PATH_MAX + 64];
+static double energy_uj = 0;
+static float power = 0;			// package plus fan power, last step
+
+//------------------------------------------------------------------------------
+
+static double sim_clock()
+{
+	return sim_time;
+}
+
+//------------------------------------------------------------------------------
+
+static void put(char *attr, char *fmt, float val)
+{
+	char fname[PATH_MAX + 128];
+
+	snprintf(fname, sizeof(fname), "%s/%s", dev, attr);
+
+	FILE *fp = fopen(fname, "w");
+	if(fp == NULL)
+	{
+		printf("Error: Can't create %s\n", fname);
+		exit(-1);
+	}
+
+	fprintf(fp, fmt, val);
+	fclose(fp);
+}
+
+//------------------------------------------------------------------------------
+
+static int get(char *attr)
+{
+	char fname[PATH_MAX + 128];
+	int val = 0;
+
+	snprintf(fname, sizeof(fname), "%s/%s", dev, attr);
+
+	FILE *fp = fopen(fname, "r");
+	if(fp != NULL)
+	{
+		if(fscanf(fp, "%d", &val) != 1)
+		{
+			val = 0;
+		}
+		fclose(fp);
+	}
+
+	return val;
+}
+
+//------------------------------------------------------------------------------
+// fake sysfs: <root>/sys/class/hwmon/hwmon0/{name,tempN_*,fanN_*}
+
+static void create_tree()
+{
+	char path[PATH_MAX + 128];
+	char attr[32];
+	int i;
+
+	strcpy(root, "/tmp/macfansim.XXXXXX");
+	if(mkdtemp(root) == NULL)
+	{
+		printf("Error: Can't create %s\n", root);
+		exit(-1);
+	}
+
+	snprintf(path, sizeof(path), "%s/sys", root);
+	mkdir(path, 0755);
+	snprintf(path, sizeof(path), "%s/sys/class", root);
+	mkdir(path, 0755);
+	snprintf(path, sizeof(path), "%s/sys/class/hwmon", root);
+	mkdir(path, 0755);
+	snprintf(dev, sizeof(dev), "%s/sys/class/hwmon/hwmon0", root);
+	mkdir(dev, 0755);
+
+	put("name", "applesmc\n", 0);
+
+	for(i = 0; i < N_PLANT; ++i)
+	{
+		FILE *fp;
+		char fname[PATH_MAX + 128];
+
+		snprintf(fname, sizeof(fname), "%s/temp%d_label", dev, i + 1);
+		fp = fopen(fname, "w");
+		if(fp != NULL)
+		{
+			fprintf(fp, "%s\n", plant[i].key);
+			fclose(fp);
+		}
+	}
+
+	for(i = 0; i < MAX_FANS; ++i)
+	{
+		sprintf(attr, "fan%d_min", i + 1);
+		put(attr, "%.0f", FAN_HW_MIN);
+		sprintf(attr, "fan%d_manual", i + 1);
+		put(attr, "%.0f", 0);
+	}
+
+	// RAPL package 0
+
+	snprintf(path, sizeof(path), "%s/sys/class/powercap", root);
+	mkdir(path, 0755);
+	snprintf(rapl, sizeof(rapl), "%s/sys/class/powercap/intel-rapl:0", root);
+	mkdir(rapl, 0755);
+
+	snprintf(path, sizeof(path), "%s/max_energy_range_uj", rapl);
+	FILE *fp = fopen(path, "w");
+	if(fp != NULL)
+	{
+		fprintf(fp, "%.0f\n", RAPL_RANGE);
+		fclose(fp);
+	}
+
+	snprintf(path, sizeof(path), "%s/energy_uj", rapl);
+	fp = fopen(path, "w");
+	if(fp != NULL)
+	{
+		fprintf(fp, "0\n");
+		fclose(fp);
+	}
+
+	strcpy(sysfs_root, root);
+}
+
+//------------------------------------------------------------------------------
+
+static void remove_tree()
+{
+	char cmd[PATH_MAX + 16];
+
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", root);
+	if(system(cmd) != 0)
+	{
+		printf("Error: Can't remove %s\n", root);
+	}
+}
+
+//------------------------------------------------------------------------------
+// export plant state to the fake sysfs, as the SMC would
+
+static void publish()
+{
+	char attr[32];
+	int i;
+
+	for(i = 0; i < N_PLANT; ++i)
+	{
+		sprintf(attr, "temp%d_input", i + 1);
+		put(attr, "%.0f", plant[i].temp * 1000);
+	}
+
+	for(i = 0; i < MAX_FANS; ++i)
+	{
+		sprintf(attr, "fan%d_input", i + 1);
+		put(attr, "%.0f", rpm[i]);
+	}
+
+	char fname[PATH_MAX + 96];
+	snprintf(fname, sizeof(fname), "%s/energy_uj", rapl);
+
+	FILE *fp = fopen(fname, "w");
+	if(fp != NULL)
+	{
+		fprintf(fp, "%.0f\n", energy_uj);
+		fclose(fp);
+	}
+}
+
+//------------------------------------------------------------------------------
+
+static float plant_temp(char *key)
+{
+	int i;
+
+	for(i = 0; i < N_PLANT; ++i)
+	{
+		if(strcmp(plant[i].key, key) == 0)
+		{
+			return plant[i].temp;
+		}
+	}
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static void step_plant(float load)
+{
+	char attr[32];
+	int i;
+
+	for(i = 0; i < MAX_FANS; ++i)
+	{
+		sprintf(attr, "fan%d_min", i + 1);
+		float target = max(FAN_HW_MIN, get(attr));
+		rpm[i] += (target - rpm[i]) * T_STEP / FAN_TAU;
+	}
+
+	float cooling = (rpm[0] + rpm[MAX_FANS - 1]) / 2 / 6200;
+
+	for(i = 0; i < N_PLANT; ++i)
+	{
+		struct plant *p = &plant[i];
+		float t_ss = t_amb + (p->idle + load * p->load_gain) / (1 + p->cool * cooling);
+		p->temp += (t_ss - p->temp) * T_STEP / p->tau;
+	}
+
+	float pkg = PKG_IDLE + load * PKG_LOAD + PKG_LEAK * exp((plant_temp("TC0D") - PKG_LEAK_T0) / PKG_LEAK_T);
+
+	energy_uj = fmod(energy_uj + pkg * T_STEP * 1e6, RAPL_RANGE);
+
+	power = pkg;
+	for(i = 0; i < MAX_FANS; ++i)
+	{
+		float r = rpm[i] / 6200;
+		power += FAN_POWER * r * r * r;
+	}
+}
+
+//------------------------------------------------------------------------------
+// start cold, at idle equilibrium with fans at hardware min
+
+static void reset_plant()
+{
+	int i;
+
+	sim_time = 0;
+	for(i = 0; i < N_PLANT; ++i)
+	{
+		plant[i].temp = t_amb + plant[i].idle / (1 + plant[i].cool * FAN_HW_MIN / 6200);
+	}
+	for(i = 0; i < MAX_FANS; ++i)
+	{
+		rpm[i] = FAN_HW_MIN;
+	}
+
+	publish();
+	scan_sensors();
+}
+
+//------------------------------------------------------------------------------
+// autotune hooks, the plant stands in for the CPU burners and the clock
+
+static void sim_wait(int seconds)
+{
+	int t;
+
+	for(t = 0; t < seconds; t += T_STEP)
+	{
+		step_plant(tune_level);
+		sim_time += T_STEP;
+	}
+
+	publish();
+}
+
+static void sim_load(int on)
+{
+	tune_level = on ? 0.8 : 0.05;
+}
+
+//------------------------------------------------------------------------------
+
+static void run(struct scenario *sc, struct result *res)
+{
+	int i;
+	int s;
+	int t;
+	int total = 0;
+	int last_change = 0;
+
+	for(s = 0; sc->seg[s].duration > 0; ++s)
+	{
+		if(s > 0)
+		{
+			last_change = total;
+		}
+		total += sc->seg[s].duration;
+	}
+
+	float *tc0p = malloc(sizeof(float) * (total + 1));
+	if(tc0p == NULL)
+	{
+		exit(-1);
+	}
+
+	reset_plant();
+
+	memset(res, 0, sizeof(*res));
+
+	unsigned long writes = fan_writes;
+	int changes = 0;
+	int last_speed = -1;
+	double rpm_sum = 0;
+	double rpm_sq = 0;
+	double power_sum = 0;
+	int samples = 0;
+
+	t = 0;
+	for(s = 0; sc->seg[s].duration > 0; ++s)
+	{
+		int end = t + sc->seg[s].duration;
+
+		for(; t < end; ++t)
+		{
+			if(t % period == 0)
+			{
+				publish();
+				adjust();
+
+				if(fan_speed != last_speed)
+				{
+					++changes;
+					last_speed = fan_speed;
+				}
+			}
+
+			step_plant(sc->seg[s].load);
+			sim_time += T_STEP;
+
+			// score
+
+			float avg = 0;
+			for(i = 0; i < N_PLANT; ++i)
+			{
+				avg += plant[i].temp;
+			}
+			avg /= N_PLANT;
+
+			float cpu = plant_temp("TC0P");
+			float gpu = plant_temp("TG0P");
+
+			res->peak = max(res->peak, max(cpu, gpu));
+
+			if(avg > profile->temp_avg_ceiling || cpu > profile->temp_TC0P_ceiling ||
+			   gpu > profile->temp_TG0P_ceiling)
+			{
+				res->above += T_STEP;
+			}
+
+			tc0p[t] = cpu;
+
+			rpm_sum += rpm[0];
+			rpm_sq += rpm[0] * rpm[0];
+			power_sum += power;
+			++samples;
+		}
+	}
+
+	// settled when TC0P stays within SETTLE_BAND of its final value
+
+	float final = tc0p[total - 1];
+	int settled = total - 1;
+	while(settled > last_change && fabs(tc0p[settled - 1] - final) <= SETTLE_BAND)
+	{
+		--settled;
+	}
+	res->settle = settled - last_change;
+
+	double mean = rpm_sum / samples;
+	res->rpm_mean = mean;
+	res->rpm_sd = sqrt(max(0, rpm_sq / samples - mean * mean));
+	res->writes_h = (fan_writes - writes) * 3600.0 / total;
+	res->changes_h = changes * 3600.0 / total;
+	res->power = power_sum / samples;
+
+	free(tc0p);
+}
+
+//------------------------------------------------------------------------------
+
+void usage()
+{
+	printf("usage: macfansim [-c config] [-s scenario] [-a ambient] [-p period] [-v]\n");
+	printf("       macfansim -t fragment [-c config] [-a ambient]\n");
+	printf("  -c  config file, default is built in values\n");
+	printf("  -s  run only this scenario:");
+	int i;
+	for(i = 0; i < N_SCENARIOS; ++i)
+	{
+		printf(" %s", scenarios[i].name);
+	}
+	printf("\n");
+	printf("  -a  ambient temperature, default 25\n");
+	printf("  -p  control period in seconds, default 5\n");
+	printf("  -v  keep log_level from config\n");
+	printf("  -t  run --autotune against the plant, write the result to fragment\n");
+	exit(-1);
+}
+
+//-----------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+	int i;
+	char *cfg = "/dev/null";
+	char *only = NULL;
+	char *tune = NULL;
+	int verbose = 0;
+
+	for(i = 1; i < argc; ++i)
+	{
+		if(strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+		{
+			cfg = argv[++i];
+		}
+		else if(strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+		{
+			only = argv[++i];
+		}
+		else if(strcmp(argv[i], "-a") == 0 && i + 1 < argc)
+		{
+			t_amb = atof(argv[++i]);
+		}
+		else if(strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+		{
+			period = max(1, atoi(argv[++i]));
+		}
+		else if(strcmp(argv[i], "-v") == 0)
+		{
+			verbose = 1;
+		}
+		else if(strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+		{
+			tune = argv[++i];
+		}
+		else
+		{
+			usage();
+		}
+	}
+
+	get_time = sim_clock;
+
+	read_cfg(cfg);
+
+	if(! verbose)
+	{
+		log_level = 0;
+	}
+
+	create_tree();
+	find_applesmc();
+	find_rapl();
+
+	if(tune != NULL)
+	{
+		tune_wait = sim_wait;
+		tune_load = sim_load;
+
+		reset_plant();
+		int run = 1;
+		int ret = autotune(tune, &run);
+
+		remove_tree();
+		return ret == 0 ? 0 : 1;
+	}
+
+	struct result res[N_SCENARIOS];
+
+	for(i = 0; i < N_SCENARIOS; ++i)
+	{
+		if(only == NULL || strcmp(only, scenarios[i].name) == 0)
+		{
+			run(&scenarios[i], &res[i]);
+		}
+	}
+
+	// score card
+
+	printf("\n%-10s %8s %9s %9s %8s %8s %9s %10s %9s\n",
+		   "scenario", "peak(C)", "above(s)", "settle(s)", "rpm", "rpm_sd", "writes/h", "changes/h", "power(W)");
+
+	for(i = 0; i < N_SCENARIOS; ++i)
+	{
+		if(only == NULL || strcmp(only, scenarios[i].name) == 0)
+		{
+			printf("%-10s %8.1f %9.0f %9.0f %8.0f %8.0f %9.0f %10.0f %9.2f\n",
+				   scenarios[i].name, res[i].peak, res[i].above, res[i].settle,
+				   res[i].rpm_mean, res[i].rpm_sd, res[i].writes_h, res[i].changes_h, res[i].power);
+		}
+	}
+
+	remove_tree();
+
+	return 0;
+}
+
+//-----------------------------------------------------------------------------
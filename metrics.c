@@ -0,0 +1,267 @@
+/*
+ *  metrics.c -  Fan control daemon for MacBook
+ *
+ *  Copyright (C) 2010  Mikael Strom <mikael@sesamiq.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  Metrics in Prometheus text format for the node_exporter textfile
+ *  collector. The file is written to <metrics_file>.tmp and renamed, so the
+ *  collector never sees a partial file. All output is formatted into a
+ *  static buffer, exporting does no allocation.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include "config.h"
+#include "control.h"
+#include "cpufreq.h"
+#include "metrics.h"
+#include "shadow.h"
+#include "alarm.h"
+#include "energy.h"
+
+//------------------------------------------------------------------------------
+
+#define METRICS_BUF_SIZE	65536
+#define PREFIX				"macfanctld_"
+
+static char buf[METRICS_BUF_SIZE];
+static int len;
+static double last_export = -1;
+
+//------------------------------------------------------------------------------
+
+static void out(char *fmt, ...)
+{
+	va_list ap;
+
+	if(len >= sizeof(buf))
+	{
+		return;			// full, truncated output is detected in metrics_export
+	}
+
+	va_start(ap, fmt);
+	len += vsnprintf(buf + len, sizeof(buf) - len, fmt, ap);
+	va_end(ap);
+}
+
+//------------------------------------------------------------------------------
+// label values must have '\' and '"' escaped
+
+static void out_label(char *val)
+{
+	char esc[2 * PATH_MAX];
+	int i = 0;
+
+	for(; *val && i < sizeof(esc) - 2; ++val)
+	{
+		if(*val == '\\' || *val == '"')
+		{
+			esc[i++] = '\\';
+		}
+		esc[i++] = *val;
+	}
+	esc[i] = 0;
+
+	out("%s", esc);
+}
+
+//------------------------------------------------------------------------------
+
+static void out_help(char *name, char *type, char *help)
+{
+	out("# HELP " PREFIX "%s %s\n# TYPE " PREFIX "%s %s\n", name, help, name, type);
+}
+
+//------------------------------------------------------------------------------
+
+static void format()
+{
+	int i;
+
+	len = 0;
+
+	out_help("temperature_celsius", "gauge", "Sensor temperature.");
+	for(i = 0; i < sensor_count; ++i)
+	{
+		if(sensor_polled(&sensors[i]))
+		{
+			out(PREFIX "temperature_celsius{chip=\"");
+			out_label(sensors[i].chip->name);
+			out("\",device=\"");
+			out_label(sensors[i].chip->path);
+			out("\",label=\"");
+			out_label(sensors[i].name);
+			out("\"} %.2f\n", sensors[i].value);
+		}
+	}
+
+	out_help("sensor_rejected", "gauge", "1 for temp_avg sensors rejected as outliers.");
+	for(i = 0; i < sensor_count; ++i)
+	{
+		if(! sensors[i].excluded && sensors[i].in_avg)
+		{
+			out(PREFIX "sensor_rejected{chip=\"");
+			out_label(sensors[i].chip->name);
+			out("\",device=\"");
+			out_label(sensors[i].chip->path);
+			out("\",label=\"");
+			out_label(sensors[i].name);
+			out("\"} %d\n", sensors[i].rejected);
+		}
+	}
+
+	out_help("source_temperature_celsius", "gauge", "Temperature of each control source.");
+	out(PREFIX "source_temperature_celsius{source=\"AVG\"} %.2f\n", temp_avg);
+	if(sensor_TC0P != NULL)
+	{
+		out(PREFIX "source_temperature_celsius{source=\"TC0P\"} %.2f\n", sensor_TC0P->value);
+	}
+	if(sensor_TG0P != NULL)
+	{
+		out(PREFIX "source_temperature_celsius{source=\"TG0P\"} %.2f\n", sensor_TG0P->value);
+	}
+
+	out_help("control_source", "gauge", "1 for the source controlling the fan speed (fan_ctl).");
+	for(i = CTL_NONE; i <= CTL_TG0P; ++i)
+	{
+		out(PREFIX "control_source{source=\"%s\"} %d\n", ctl_name(i), fan_ctl == i);
+	}
+
+	out_help("fan_speed_rpm", "gauge", "Fan speed calculated from the temperatures.");
+	out(PREFIX "fan_speed_rpm %d\n", fan_speed);
+
+	out_help("fan_target_rpm", "gauge", "Speed requested from the fan, including correction.");
+	for(i = 0; i < fan_count; ++i)
+	{
+		out(PREFIX "fan_target_rpm{fan=\"%d\"} %d\n", fans[i].id, fans[i].target + fans[i].correction);
+	}
+
+	out_help("fan_actual_rpm", "gauge", "Measured fan speed.");
+	for(i = 0; i < fan_count; ++i)
+	{
+		out(PREFIX "fan_actual_rpm{fan=\"%d\"} %d\n", fans[i].id, fans[i].actual);
+	}
+
+	out_help("fan_alarm", "gauge", "0 ok, 1 stalled, 2 degraded.");
+	for(i = 0; i < fan_count; ++i)
+	{
+		out(PREFIX "fan_alarm{fan=\"%d\"} %d\n", fans[i].id, fans[i].alarm);
+	}
+
+	out_help("cpufreq_cap_ratio", "gauge", "CPU frequency cap, 1 when not capped.");
+	out(PREFIX "cpufreq_cap_ratio %.2f\n", cpufreq_cap_pct / 100.0);
+
+	if(opt_speed > -1 && package_power >= 0)
+	{
+		out_help("package_power_watts", "gauge", "RAPL package power over the last optimizer dwell.");
+		out(PREFIX "package_power_watts %.2f\n", package_power);
+
+		out_help("optimizer_saved_watts", "gauge", "Package plus fan power saved against the ramp speed.");
+		out(PREFIX "optimizer_saved_watts %.2f\n", power_saved);
+	}
+
+	out_help("cycle_duration_seconds", "gauge", "Time spent in the last control cycle.");
+	out(PREFIX "cycle_duration_seconds %.6f\n", cycle_time);
+
+	out_help("sensor_reads_total", "counter", "Sensor reads.");
+	out(PREFIX "sensor_reads_total %lu\n", sensor_reads);
+
+	out_help("read_errors_total", "counter", "Failed sensor and fan reads.");
+	out(PREFIX "read_errors_total %lu\n", read_errors);
+
+	out_help("fan_writes_total", "counter", "Fan speed writes issued to the SMC.");
+	out(PREFIX "fan_writes_total %lu\n", fan_writes);
+
+	out_help("fan_writes_elided_total", "counter", "Fan speed writes skipped, value unchanged.");
+	out(PREFIX "fan_writes_elided_total %lu\n", fan_writes_elided);
+
+	out_help("resumes_total", "counter", "Resumes from suspend detected.");
+	out(PREFIX "resumes_total %lu\n", resumes);
+
+	out_help("alarm_wakeups_total", "counter", "Cycles started early by a hwmon temperature alarm.");
+	out(PREFIX "alarm_wakeups_total %lu\n", alarm_wakeups);
+
+	out_help("config_reloads_total", "counter", "Config reloads.");
+	out(PREFIX "config_reloads_total %lu\n", config_reloads);
+
+	if(shadow_active)
+	{
+		out_help("shadow_fan_speed_rpm", "gauge", "Fan speed the shadow config would have set.");
+		out(PREFIX "shadow_fan_speed_rpm %d\n", shadow_speed);
+
+		out_help("shadow_decisions_total", "counter", "Shadow decisions since the config was loaded.");
+		out(PREFIX "shadow_decisions_total %lu\n", shadow.samples);
+
+		out_help("shadow_differing_decisions_total", "counter", "Shadow decisions off by more than fan_tolerance, or on another source.");
+		out(PREFIX "shadow_differing_decisions_total %lu\n", shadow.differ);
+
+		out_help("shadow_rpm_difference_sum", "counter", "Sum of the absolute rpm difference, divide by decisions for the mean.");
+		out(PREFIX "shadow_rpm_difference_sum %.0f\n", shadow.sum_diff);
+
+		out_help("shadow_rpm_difference_max", "gauge", "Largest absolute rpm difference.");
+		out(PREFIX "shadow_rpm_difference_max %d\n", shadow.max_diff);
+
+		out_help("shadow_louder_seconds_total", "counter", "Time the shadow would have run the fan faster.");
+		out(PREFIX "shadow_louder_seconds_total %.0f\n", shadow.louder);
+
+		out_help("shadow_quieter_seconds_total", "counter", "Time the shadow would have run the fan slower.");
+		out(PREFIX "shadow_quieter_seconds_total %.0f\n", shadow.quieter);
+	}
+}
+
+//------------------------------------------------------------------------------
+
+void metrics_export()
+{
+	char tmp_name[PATH_MAX + 8];
+	double now = get_time();
+
+	if(metrics_file[0] == 0 || (last_export >= 0 && now - last_export < metrics_interval))
+	{
+		return;
+	}
+
+	last_export = now;
+
+	format();
+
+	if(len >= sizeof(buf))
+	{
+		printf("Error: Metrics truncated, %d bytes needed\n", len);
+		len = sizeof(buf) - 1;
+	}
+
+	snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", metrics_file);
+
+	int fd = open(tmp_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0)
+	{
+		printf("Error: Can't open %s\n", tmp_name);
+		return;
+	}
+
+	int n = write(fd, buf, len);
+	close(fd);
+
+	if(n != len || rename(tmp_name, metrics_file) != 0)
+	{
+		printf("Error: Can't write %s\n", metrics_file);
+		unlink(tmp_name);
+	}
+}
+
+//------------------------------------------------------------------------------
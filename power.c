@@ -0,0 +1,168 @@
+/*
+ *  power.c -  Fan control daemon for MacBook
+ *
+ *  Copyright (C) 2010  Mikael Strom <mikael@sesamiq.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  Selects profile_ac or profile_battery depending on the power source.
+ *  All profiles are parsed by read_cfg(), switching is a pointer swap.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <limits.h>
+#include "config.h"
+#include "hwmon.h"
+#include "power.h"
+
+//------------------------------------------------------------------------------
+
+#define POWER_SUPPLY_DIR	"/sys/class/power_supply"
+#define MAX_SUPPLIES		8
+
+static char online[MAX_SUPPLIES][PATH_MAX + 336];	// 'online' attribute of each adapter
+static int supply_count = 0;
+
+//------------------------------------------------------------------------------
+
+void find_power_supplies()
+{
+	DIR *fd_dir;
+	char dir[PATH_MAX + 32];
+
+	supply_count = 0;
+
+	snprintf(dir, sizeof(dir), "%s" POWER_SUPPLY_DIR, sysfs_root);
+
+	fd_dir = opendir(dir);
+	if(fd_dir != NULL)
+	{
+		struct dirent *dir_entry;
+
+		while((dir_entry = readdir(fd_dir)) != NULL && supply_count < MAX_SUPPLIES)
+		{
+			char fname[PATH_MAX + 320];
+			char type[16];
+
+			if(dir_entry->d_name[0] == '.')
+			{
+				continue;
+			}
+
+			// everything but batteries, i.e. Mains and USB adapters
+
+			snprintf(fname, sizeof(fname), "%s/%s/type", dir, dir_entry->d_name);
+
+			int fd = open(fname, O_RDONLY);
+			if(fd < 0)
+			{
+				continue;
+			}
+
+			int n = read(fd, type, sizeof(type) - 1);
+			close(fd);
+
+			if(n < 1)
+			{
+				continue;
+			}
+			type[n] = 0;
+
+			if(strncmp(type, "Battery", 7) != 0)
+			{
+				snprintf(online[supply_count], sizeof(online[0]), "%s/%s/online", dir, dir_entry->d_name);
+				if(access(online[supply_count], R_OK) == 0)
+				{
+					++supply_count;
+				}
+			}
+		}
+		closedir(fd_dir);
+	}
+
+	printf("Found %d power adapters.\n", supply_count);
+	fflush(stdout);
+}
+
+//------------------------------------------------------------------------------
+// no adapters found means desktop, always on AC
+
+static int on_ac()
+{
+	int i;
+
+	if(supply_count == 0)
+	{
+		return 1;
+	}
+
+	for(i = 0; i < supply_count; ++i)
+	{
+		char buf[4];
+
+		int fd = open(online[i], O_RDONLY);
+		if(fd > -1)
+		{
+			int n = read(fd, buf, 1);
+			close(fd);
+
+			if(n == 1 && buf[0] == '1')
+			{
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+void select_profile()
+{
+	struct profile *p;
+	char *why;
+
+	if(profile_forced != NULL)
+	{
+		p = profile_forced;
+		why = "forced";
+	}
+	else if(on_ac())
+	{
+		p = profile_ac;
+		why = "AC";
+	}
+	else
+	{
+		p = profile_battery;
+		why = "battery";
+	}
+
+	if(p == NULL)
+	{
+		p = &profiles[0];
+	}
+
+	if(p != profile)
+	{
+		profile = p;
+
+		printf("Using profile %s (%s)\n", profile->name, why);
+		fflush(stdout);
+	}
+}
+
+//------------------------------------------------------------------------------
@@ -0,0 +1,63 @@
+/*
+ *  probes.h -  Fan control daemon for MacBook
+ *
+ *  Copyright (C) 2010  Mikael Strom <mikael@sesamiq.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  USDT probes, provider macfanctld. A probe is a nop until a tracer
+ *  attaches, i.e.
+ *
+ *    bpftrace -e 'usdt:/usr/sbin/macfanctld:fan_write { printf("%d %d\n", arg0, arg1); }'
+ *
+ *  Without sys/sdt.h (systemtap-sdt-dev), or with -DNO_PROBES, the probes
+ *  compile to nothing.
+ *
+ *  read_sensors_start
+ *  read_sensors_end	reads, errors				(this cycle)
+ *  sensor_read			chip, label, id, millidegrees, ok
+ *  calc_fan			source (CTL_*), speed, speed before slew limit
+ *  fan_write			fan id, rpm, ok
+ *  config_reload		reload count
+ *  temp_alarm			sensor id, 1 if crit
+ */
+
+#ifndef PROBES_H_
+#define PROBES_H_
+
+#if ! defined(NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define HAVE_PROBES
+#endif
+#endif
+
+#ifdef HAVE_PROBES
+
+#define PROBE(name)						DTRACE_PROBE(macfanctld, name)
+#define PROBE1(name, a)					DTRACE_PROBE1(macfanctld, name, a)
+#define PROBE2(name, a, b)				DTRACE_PROBE2(macfanctld, name, a, b)
+#define PROBE3(name, a, b, c)			DTRACE_PROBE3(macfanctld, name, a, b, c)
+#define PROBE5(name, a, b, c, d, e)		DTRACE_PROBE5(macfanctld, name, a, b, c, d, e)
+
+#else
+
+// arguments are still referenced, so values kept only for a probe don't warn
+
+#define PROBE(name)						do { } while(0)
+#define PROBE1(name, a)					do { (void)(a); } while(0)
+#define PROBE2(name, a, b)				do { (void)(a); (void)(b); } while(0)
+#define PROBE3(name, a, b, c)			do { (void)(a); (void)(b); (void)(c); } while(0)
+#define PROBE5(name, a, b, c, d, e)		do { (void)(a); (void)(b); (void)(c); (void)(d); (void)(e); } while(0)
+
+#endif
+
+#endif /* PROBES_H_ */
@@ -0,0 +1,142 @@
+/*
+ *  shadow.c -  Fan control daemon for MacBook
+ *
+ *  Copyright (C) 2010  Mikael Strom <mikael@sesamiq.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  Shadow controller. The profiles of shadow_cfg are evaluated every cycle
+ *  on the sensor values adjust() just read, and the decision is compared to
+ *  the active profile's ramp speed on the same values. Slew limits, PID and
+ *  the optimizer are left out on both sides, so only the profiles make a
+ *  difference. Nothing is read or written here. The shadow profile used is
+ *  the one named like the active profile, or its default.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "control.h"
+#include "shadow.h"
+
+//------------------------------------------------------------------------------
+
+static struct profile shadow_profiles[MAX_PROFILES];
+static int shadow_count = 0;
+static double last_eval = -1;
+
+int shadow_active = 0;
+int shadow_speed = 0;
+int shadow_ctl = CTL_NONE;
+struct shadow_stats shadow;
+
+//------------------------------------------------------------------------------
+
+void shadow_load()
+{
+	shadow_active = 0;
+	shadow_count = 0;
+	last_eval = -1;
+	memset(&shadow, 0, sizeof(shadow));
+
+	if(shadow_cfg[0] == 0)
+	{
+		return;
+	}
+
+	shadow_count = read_cfg_profiles(shadow_cfg, shadow_profiles);
+
+	if(shadow_count == 0)
+	{
+		printf("Error: Can't read shadow config %s\n", shadow_cfg);
+		return;
+	}
+
+	shadow_active = 1;
+
+	printf("Shadow config %s, %d profiles.\n", shadow_cfg, shadow_count);
+	fflush(stdout);
+}
+
+//------------------------------------------------------------------------------
+
+static struct profile *shadow_profile()
+{
+	int i;
+
+	for(i = 0; i < shadow_count; ++i)
+	{
+		if(strcmp(shadow_profiles[i].name, profile->name) == 0)
+		{
+			return &shadow_profiles[i];
+		}
+	}
+
+	return &shadow_profiles[0];
+}
+
+//------------------------------------------------------------------------------
+
+void shadow_eval()
+{
+	double now = get_time();
+
+	if(! shadow_active)
+	{
+		return;
+	}
+
+	int active_ctl;
+	int active_speed = calc_speed(profile, &active_ctl);
+
+	shadow_speed = calc_speed(shadow_profile(), &shadow_ctl);
+
+	double dt = last_eval < 0 ? 0 : now - last_eval;
+	int diff = shadow_speed - active_speed;
+
+	last_eval = now;
+	++shadow.samples;
+	shadow.sum_diff += abs(diff);
+	shadow.max_diff = max(shadow.max_diff, abs(diff));
+
+	if(diff > fan_tolerance)
+	{
+		shadow.louder += dt;
+	}
+	else if(diff < -fan_tolerance)
+	{
+		shadow.quieter += dt;
+	}
+
+	if(abs(diff) > fan_tolerance || shadow_ctl != active_ctl)
+	{
+		++shadow.differ;
+	}
+}
+
+//------------------------------------------------------------------------------
+
+void shadow_report()
+{
+	if(! shadow_active || shadow.samples == 0)
+	{
+		return;
+	}
+
+	printf("Shadow %s, %lu samples:\n", shadow_cfg, shadow.samples);
+	printf("\tdiffering decisions: %lu (%.1f%%)\n", shadow.differ, 100.0 * shadow.differ / shadow.samples);
+	printf("\tmean rpm difference: %.0f, max: %d\n", shadow.sum_diff / shadow.samples, shadow.max_diff);
+	printf("\tlouder: %.0fs, quieter: %.0fs\n", shadow.louder, shadow.quieter);
+	fflush(stdout);
+}
+
+//------------------------------------------------------------------------------
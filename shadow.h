@@ -0,0 +1,39 @@
+/*
+ *  shadow.h -  Fan control daemon for MacBook
+ *
+ *  Copyright (C) 2010  Mikael Strom <mikael@sesamiq.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ */
+
+#ifndef SHADOW_H_
+#define SHADOW_H_
+
+struct shadow_stats
+{
+	unsigned long samples;
+	unsigned long differ;		// more than fan_tolerance apart, or other source
+	double sum_diff;			// sum of abs rpm difference
+	int max_diff;
+	double louder;				// seconds the shadow would have been louder
+	double quieter;
+};
+
+extern int shadow_active;		// 1 if a shadow config is loaded
+extern int shadow_speed;		// last shadow decision
+extern int shadow_ctl;
+extern struct shadow_stats shadow;
+
+void shadow_load();		// after every read_cfg()
+void shadow_eval();		// after every adjust()
+void shadow_report();	// print the statistics
+
+#endif /* SHADOW_H_ */
@@ -0,0 +1,318 @@
+/*
+ *  stats.c -  Fan control daemon for MacBook
+ *
+ *  Copyright (C) 2010  Mikael Strom <mikael@sesamiq.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  Rolling statistics of every sensor and fan over 1 minute, 1 hour and
+ *  24 hours. Each window is a ring of time slots, each slot holds min, max,
+ *  sum and a fixed histogram (1C or 60 rpm bins) the percentiles are taken
+ *  from. An update adds the value to the current slot of each window, old
+ *  slots are cleared as the ring turns. Memory is only allocated when the
+ *  sensors are rescanned.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "config.h"
+#include "control.h"
+#include "stats.h"
+
+//------------------------------------------------------------------------------
+
+#define STAT_BINS		128
+#define TEMP_BIN		1.0		// degrees per bin, 0 - 127C
+#define RPM_BIN			60.0	// rpm per bin, 0 - 7620 rpm
+
+struct slot
+{
+	unsigned short hist[STAT_BINS];
+	unsigned short count;
+	float min;
+	float max;
+	float sum;
+};
+
+struct window
+{
+	char *name;
+	int slot_len;		// seconds
+	int n_slots;
+	int first;			// index of first slot in series.slots
+};
+
+struct window windows[] =
+{
+	{"1m",	10,		6,	0},
+	{"1h",	60,		60,	6},
+	{"24h",	3600,	24,	66}
+};
+#define N_WINDOWS		(sizeof(windows) / sizeof(windows[0]))
+#define N_SLOTS			90		// all windows
+
+struct series
+{
+	float bin;					// width of a histogram bin
+	long cur[N_WINDOWS];		// current slot number of each window
+	struct slot slots[N_SLOTS];
+};
+
+static struct series *series = NULL;	// sensors, then fans
+static int series_count = 0;
+
+static struct sensor *stats_sensors = NULL;	// sensor table the series belong to
+static int stats_sensor_count = 0;
+static int stats_fan_count = 0;
+
+static double last_print = -1;
+
+//------------------------------------------------------------------------------
+// new series after every rescan, the sensor table may be another one
+
+static void stats_init()
+{
+	int i;
+	int w;
+
+	free(series);
+
+	series_count = sensor_count + fan_count;
+	series = calloc(series_count > 0 ? series_count : 1, sizeof(struct series));
+	assert(series != NULL);
+
+	for(i = 0; i < series_count; ++i)
+	{
+		series[i].bin = i < sensor_count ? TEMP_BIN : RPM_BIN;
+
+		for(w = 0; w < N_WINDOWS; ++w)
+		{
+			series[i].cur[w] = -1;
+		}
+	}
+
+	stats_sensors = sensors;
+	stats_sensor_count = sensor_count;
+	stats_fan_count = fan_count;
+}
+
+//------------------------------------------------------------------------------
+
+static void clear_slot(struct slot *slot)
+{
+	memset(slot, 0, sizeof(*slot));
+}
+
+//------------------------------------------------------------------------------
+
+static void add(struct series *s, float val, double now)
+{
+	int bin = val / s->bin;
+	int w;
+
+	bin = max(0, min(STAT_BINS - 1, bin));
+
+	for(w = 0; w < N_WINDOWS; ++w)
+	{
+		struct window *win = &windows[w];
+		long num = (long)(now / win->slot_len);
+
+		// the ring turned, clear the slots passed since the last update
+
+		if(num != s->cur[w])
+		{
+			long k = s->cur[w] < 0 || num - s->cur[w] > win->n_slots ? num - win->n_slots + 1 : s->cur[w] + 1;
+
+			for(k = max(k, 0); k <= num; ++k)
+			{
+				clear_slot(&s->slots[win->first + k % win->n_slots]);
+			}
+			s->cur[w] = num;
+		}
+
+		struct slot *slot = &s->slots[win->first + num % win->n_slots];
+
+		if(slot->count == 0 || val < slot->min)
+		{
+			slot->min = val;
+		}
+		if(slot->count == 0 || val > slot->max)
+		{
+			slot->max = val;
+		}
+
+		if(slot->count < 0xffff && slot->hist[bin] < 0xffff)
+		{
+			slot->sum += val;
+			++slot->hist[bin];
+			++slot->count;
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+
+void stats_update()
+{
+	double now = get_time();
+	int i;
+
+	if(sensors != stats_sensors || sensor_count != stats_sensor_count || fan_count != stats_fan_count)
+	{
+		stats_init();
+	}
+
+	for(i = 0; i < sensor_count; ++i)
+	{
+		if(sensor_polled(&sensors[i]))
+		{
+			add(&series[i], sensors[i].value, now);
+		}
+	}
+
+	for(i = 0; i < fan_count; ++i)
+	{
+		add(&series[sensor_count + i], fans[i].actual, now);
+	}
+
+	if(last_print < 0)
+	{
+		last_print = now;
+	}
+	else if(stats_interval > 0 && now - last_print >= stats_interval)
+	{
+		stats_print();
+		last_print = now;
+	}
+}
+
+//------------------------------------------------------------------------------
+// value below which q of the samples are, middle of the bin, within min / max
+
+static float percentile(unsigned int *hist, unsigned int count, float bin, float q, float lo, float hi)
+{
+	unsigned int acc = 0;
+	int i;
+
+	for(i = 0; i < STAT_BINS - 1; ++i)
+	{
+		acc += hist[i];
+		if(acc >= q * count)
+		{
+			break;
+		}
+	}
+
+	float val = (i + 0.5) * bin;
+
+	return max(lo, min(hi, val));
+}
+
+//------------------------------------------------------------------------------
+
+static void print_series(struct series *s, char *name, char *fmt)
+{
+	int w;
+	int i;
+	int b;
+
+	for(w = 0; w < N_WINDOWS; ++w)
+	{
+		struct window *win = &windows[w];
+		unsigned int hist[STAT_BINS];
+		unsigned int count = 0;
+		float lo = 0;
+		float hi = 0;
+		double sum = 0;
+
+		memset(hist, 0, sizeof(hist));
+
+		for(i = 0; i < win->n_slots; ++i)
+		{
+			struct slot *slot = &s->slots[win->first + i];
+
+			if(slot->count == 0)
+			{
+				continue;
+			}
+
+			lo = count == 0 ? slot->min : min(lo, slot->min);
+			hi = count == 0 ? slot->max : max(hi, slot->max);
+			sum += slot->sum;
+			count += slot->count;
+
+			for(b = 0; b < STAT_BINS; ++b)
+			{
+				hist[b] += slot->hist[b];
+			}
+		}
+
+		if(count == 0)
+		{
+			continue;
+		}
+
+		printf("\t%-24s %-4s", w == 0 ? name : "", win->name);
+		printf(fmt, lo);
+		printf(fmt, sum / count);
+		printf(fmt, hi);
+		printf(fmt, percentile(hist, count, s->bin, 0.50, lo, hi));
+		printf(fmt, percentile(hist, count, s->bin, 0.95, lo, hi));
+		printf(fmt, percentile(hist, count, s->bin, 0.99, lo, hi));
+		printf("\n");
+	}
+}
+
+//------------------------------------------------------------------------------
+
+void stats_print()
+{
+	char name[CHIPNAME_MAXLEN + SENSKEY_MAXLEN];
+	int i;
+
+	if(series == NULL)
+	{
+		return;
+	}
+
+	printf("Statistics:\n\t%-24s %-4s %7s %7s %7s %7s %7s %7s\n", "", "", "min", "mean", "max", "p50", "p95", "p99");
+
+	for(i = 0; i < stats_sensor_count; ++i)
+	{
+		if(! sensor_polled(&sensors[i]))
+		{
+			continue;
+		}
+
+		if(sensors[i].chip == chip_applesmc)
+		{
+			snprintf(name, sizeof(name), "%s", sensors[i].name);
+		}
+		else
+		{
+			snprintf(name, sizeof(name), "%s/%s", sensors[i].chip->name, sensors[i].name);
+		}
+
+		print_series(&series[i], name, " %7.1f");
+	}
+
+	for(i = 0; i < stats_fan_count; ++i)
+	{
+		snprintf(name, sizeof(name), "fan%d", fans[i].id);
+		print_series(&series[stats_sensor_count + i], name, " %7.0f");
+	}
+
+	fflush(stdout);
+}
+
+//------------------------------------------------------------------------------
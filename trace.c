@@ -0,0 +1,418 @@
+/*
+ *  trace.c -  Fan control daemon for MacBook
+ *
+ *  Copyright (C) 2010  Mikael Strom <mikael@sesamiq.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  Sensor trace capture and replay.
+ *
+ *  A trace is a magic "MFT2" followed by records, all little endian:
+ *
+ *  'H' sensor table, written at start and after every rescan
+ *      u16 sensor count, u8 fan count, then per sensor:
+ *      u16 id, u8 excluded, char chip[CHIPNAME_MAXLEN], char label[SENSKEY_MAXLEN]
+ *
+ *  'S' one control cycle
+ *      u32 ms since capture start, s16 temp[sensor count] in 1/100 C,
+ *      u16 fan_speed, u8 fan_ctl, u16 rpm[fan count]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "config.h"
+#include "control.h"
+#include "hwmon.h"
+#include "trace.h"
+
+//------------------------------------------------------------------------------
+
+#define TRACE_MAGIC		"MFT2"
+
+static FILE *trace_fp = NULL;
+static double trace_start;
+static double replay_now = 0;		// capture time of the sample being replayed
+
+//------------------------------------------------------------------------------
+
+static void put_u8(int val)
+{
+	fputc(val & 0xff, trace_fp);
+}
+
+static void put_u16(int val)
+{
+	put_u8(val);
+	put_u8(val >> 8);
+}
+
+static void put_u32(unsigned int val)
+{
+	put_u16(val);
+	put_u16(val >> 16);
+}
+
+//------------------------------------------------------------------------------
+
+static int get_u8(FILE *fp, int *val)
+{
+	int c = fgetc(fp);
+
+	*val = c;
+	return c == EOF ? -1 : 0;
+}
+
+static int get_u16(FILE *fp, int *val)
+{
+	int lo;
+	int hi;
+
+	if(get_u8(fp, &lo) != 0 || get_u8(fp, &hi) != 0)
+	{
+		return -1;
+	}
+
+	*val = lo | (hi << 8);
+	return 0;
+}
+
+static int get_u32(FILE *fp, unsigned int *val)
+{
+	int lo;
+	int hi;
+
+	if(get_u16(fp, &lo) != 0 || get_u16(fp, &hi) != 0)
+	{
+		return -1;
+	}
+
+	*val = (unsigned int)lo | ((unsigned int)hi << 16);
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+
+void trace_open(char *name)
+{
+	trace_fp = fopen(name, "wb");
+
+	if(trace_fp == NULL)
+	{
+		printf("Error: Can't create trace file %s\n", name);
+		exit(-1);
+	}
+
+	fwrite(TRACE_MAGIC, 1, 4, trace_fp);
+	trace_start = get_time();
+
+	printf("Capturing trace to %s\n", name);
+}
+
+//------------------------------------------------------------------------------
+
+int trace_capturing()
+{
+	return trace_fp != NULL;
+}
+
+//------------------------------------------------------------------------------
+
+void trace_header()
+{
+	int i;
+
+	if(trace_fp == NULL)
+	{
+		return;
+	}
+
+	put_u8('H');
+	put_u16(sensor_count);
+	put_u8(fan_count);
+
+	for(i = 0; i < sensor_count; ++i)
+	{
+		char chip[CHIPNAME_MAXLEN];
+		char label[SENSKEY_MAXLEN];
+
+		memset(chip, 0, sizeof(chip));
+		memset(label, 0, sizeof(label));
+		strncpy(chip, sensors[i].chip->name, sizeof(chip) - 1);
+		strncpy(label, sensors[i].name, sizeof(label) - 1);
+
+		put_u16(sensors[i].id);
+		put_u8(sensors[i].excluded);
+		fwrite(chip, 1, sizeof(chip), trace_fp);
+		fwrite(label, 1, sizeof(label), trace_fp);
+	}
+
+	fflush(trace_fp);
+}
+
+//------------------------------------------------------------------------------
+
+void trace_sample()
+{
+	int i;
+
+	if(trace_fp == NULL)
+	{
+		return;
+	}
+
+	put_u8('S');
+	put_u32((unsigned int)((get_time() - trace_start) * 1000));
+
+	for(i = 0; i < sensor_count; ++i)
+	{
+		put_u16((int)(sensors[i].value * 100));
+	}
+
+	put_u16(fan_speed);
+	put_u8(fan_ctl);
+
+	for(i = 0; i < fan_count; ++i)
+	{
+		put_u16(fans[i].actual);
+	}
+
+	fflush(trace_fp);		// one write per cycle, nothing lost on a crash
+}
+
+//------------------------------------------------------------------------------
+
+void trace_close()
+{
+	if(trace_fp != NULL)
+	{
+		fclose(trace_fp);
+		trace_fp = NULL;
+	}
+}
+
+//------------------------------------------------------------------------------
+// replay: chips only exist by name, the sensor table is rebuilt from the trace
+
+static struct chip *replay_chip(char *name)
+{
+	struct chip *c = find_chip(name);
+
+	if(c == NULL && chip_count < MAX_CHIPS)
+	{
+		c = &chips[chip_count++];
+		strncpy(c->name, name, sizeof(c->name) - 1);
+		c->name[sizeof(c->name) - 1] = 0;
+		c->path[0] = 0;
+		c->poll_div = 1;
+
+		if(strcmp(name, "applesmc") == 0)
+		{
+			chip_applesmc = c;
+		}
+	}
+
+	return c;
+}
+
+//------------------------------------------------------------------------------
+
+static int replay_header(FILE *fp, int *n_fans)
+{
+	int count;
+	int i;
+
+	if(get_u16(fp, &count) != 0 || get_u8(fp, n_fans) != 0)
+	{
+		return -1;
+	}
+
+	struct sensor *list = calloc(count > 0 ? count : 1, sizeof(struct sensor));
+	assert(list != NULL);
+
+	for(i = 0; i < count; ++i)
+	{
+		char chip[CHIPNAME_MAXLEN];
+
+		if(get_u16(fp, &list[i].id) != 0 || get_u8(fp, &list[i].excluded) != 0 ||
+		   fread(chip, 1, sizeof(chip), fp) != sizeof(chip) ||
+		   fread(list[i].name, 1, SENSKEY_MAXLEN, fp) != SENSKEY_MAXLEN)
+		{
+			free(list);
+			return -1;
+		}
+
+		chip[sizeof(chip) - 1] = 0;
+		list[i].name[SENSKEY_MAXLEN - 1] = 0;
+		list[i].chip = replay_chip(chip);
+
+		if(list[i].chip == NULL)
+		{
+			free(list);
+			return -1;
+		}
+	}
+
+	load_sensors(list, count);
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+// replay runs on the trace clock, rate limits see the captured intervals
+
+static double replay_time()
+{
+	return replay_now;
+}
+
+//------------------------------------------------------------------------------
+// feed a captured trace through calc_fan() with the current config
+
+int trace_replay(char *name, int verbose)
+{
+	char magic[4];
+	int i;
+	int n_fans = 0;
+	int tag;
+
+	FILE *fp = fopen(name, "rb");
+	if(fp == NULL)
+	{
+		printf("Error: Can't open trace file %s\n", name);
+		return -1;
+	}
+
+	if(fread(magic, 1, 4, fp) != 4 || memcmp(magic, TRACE_MAGIC, 4) != 0)
+	{
+		printf("Error: %s is not a trace file\n", name);
+		fclose(fp);
+		return -1;
+	}
+
+	chip_count = 0;
+	chip_applesmc = NULL;
+	get_time = replay_time;
+
+	unsigned long samples = 0;
+	unsigned long differ = 0;
+	unsigned long ctl_differ = 0;
+	double sum_diff = 0;
+	int max_diff = 0;
+	double louder = 0;
+	double quieter = 0;
+	double last_t = -1;
+	int have_header = 0;
+
+	while(get_u8(fp, &tag) == 0)
+	{
+		if(tag == 'H')
+		{
+			if(replay_header(fp, &n_fans) != 0)
+			{
+				break;
+			}
+			have_header = 1;
+		}
+		else if(tag == 'S' && have_header)
+		{
+			unsigned int ms;
+			int val;
+			int rec_speed;
+			int rec_ctl;
+
+			if(get_u32(fp, &ms) != 0)
+			{
+				break;
+			}
+
+			for(i = 0; i < sensor_count; ++i)
+			{
+				if(get_u16(fp, &val) != 0)
+				{
+					break;
+				}
+				sensors[i].value = (short)val / 100.0;
+			}
+
+			if(i < sensor_count || get_u16(fp, &rec_speed) != 0 || get_u8(fp, &rec_ctl) != 0)
+			{
+				break;
+			}
+
+			for(i = 0; i < n_fans; ++i)
+			{
+				if(get_u16(fp, &val) != 0)
+				{
+					break;
+				}
+			}
+
+			// same decision path as the daemon, minus the I/O
+
+			replay_now = ms / 1000.0;
+			calc_avg();
+			calc_fan();
+
+			double t = ms / 1000.0;
+			double dt = last_t < 0 ? 0 : t - last_t;
+			int diff = fan_speed - rec_speed;
+
+			last_t = t;
+			++samples;
+			sum_diff += abs(diff);
+			max_diff = max(max_diff, abs(diff));
+
+			if(diff > fan_tolerance)
+			{
+				louder += dt;
+			}
+			else if(diff < -fan_tolerance)
+			{
+				quieter += dt;
+			}
+
+			if(abs(diff) > fan_tolerance || fan_ctl != rec_ctl)
+			{
+				++differ;
+				ctl_differ += fan_ctl != rec_ctl;
+
+				if(verbose)
+				{
+					printf("%9.1fs: recorded %4d %-4s, replay %4d %-4s (%+d)\n",
+						   t, rec_speed, ctl_name(rec_ctl), fan_speed, ctl_name(fan_ctl), diff);
+				}
+			}
+		}
+		else
+		{
+			printf("Error: Corrupt trace record\n");
+			break;
+		}
+	}
+
+	fclose(fp);
+
+	printf("Replayed %lu samples, %.0f seconds\n", samples, last_t < 0 ? 0 : last_t);
+
+	if(samples > 0)
+	{
+		printf("\tdiffering decisions: %lu (%.1f%%), other source: %lu\n",
+			   differ, 100.0 * differ / samples, ctl_differ);
+		printf("\tmean rpm difference: %.0f, max: %d\n", sum_diff / samples, max_diff);
+		printf("\tlouder: %.0fs, quieter: %.0fs\n", louder, quieter);
+	}
+
+	return 0;
+}
+
+//------------------------------------------------------------------------------
@@ -0,0 +1,28 @@
+/*
+ *  trace.h -  Fan control daemon for MacBook
+ *
+ *  Copyright (C) 2010  Mikael Strom <mikael@sesamiq.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+void trace_open(char *name);	// start capture
+void trace_header();			// after every scan_sensors()
+void trace_sample();			// after every adjust()
+void trace_close();
+int trace_capturing();			// 1 while a capture is open
+
+int trace_replay(char *name, int verbose);
+
+#endif /* TRACE_H_ */